@@ -17,31 +17,101 @@
 #include <linux/kernel.h>
 #include <linux/pci.h>
 #include <linux/module.h>
+#include <linux/moduleparam.h>
 #include <linux/device.h>
 #include <linux/poll.h>
 #include <linux/cdev.h>
+#include <linux/interrupt.h>
+#include <linux/timer.h>
+#include <linux/jiffies.h>
+#include <linux/wait.h>
+#include <linux/random.h>
+#include <linux/workqueue.h>
+#include <linux/vmalloc.h>
+#include <linux/mutex.h>
+#include <linux/sched.h>
+#include <linux/mm.h>
+#include <linux/ktime.h>
+#include <linux/slab.h>
+#include <linux/kref.h>
+
+#define CREATE_TRACE_POINTS
+#include "boltek_trace.h"
+
+#define BOLTEK_VERSION		"v1:1.2.0"
 
-#define BOLTEK_VERSION		"v1:1.0.0"
-static u16 boltek_abi_version  = 0x0001;
+/*
+ * ABI history
+ * 1: ioctl interface
+ * 2: poll()/select() wake up when a strike is ready
+ * 3: captures are queued in the driver and the board re-armed right
+ *    away; read() returns them, RESTART is no longer needed
+ * 4: the capture ring can be mmap()ed, see struct boltek_ring_header
+ * 5: GET_DATA_AND_RESTART returns a capture with its sequence number,
+ *    missed trigger count and drain time; the ring carries the same
+ *    struct stormpci_capture_info for every slot at info_offset
+ * 6: any number of readers, each with its own cursor; the ring
+ *    overwrites the oldest capture instead of dropping new ones and
+ *    can only be mapped read-only. The first reader to set the
+ *    squelch owns it until it closes the device. SET_CURSOR tells the
+ *    driver where a reader of the mapping is, for poll() and
+ *    STRIKE_READY
+ */
+static u16 boltek_abi_version  = 0x0006;
+
+static bool use_irq = 1;
+module_param(use_irq, bool, 0444);
+MODULE_PARM_DESC(use_irq, "Wait for strikes with the PLX LINTi1 interrupt "
+		 "(default 1). With 0, or when no irq is available, the "
+		 "strike ready bit is polled from a kernel timer instead");
+
+static unsigned int poll_ms = 1;
+module_param(poll_ms, uint, 0644);
+MODULE_PARM_DESC(poll_ms, "Strike ready poll period in ms when not using "
+		 "the interrupt (default 1)");
+
+static unsigned int simulate;
+module_param(simulate, uint, 0444);
+MODULE_PARM_DESC(simulate, "Create N simulated detectors at /dev/lightning-N "
+		 "instead of driving cards");
 
-#define BOLTEK_DATA_NORTH_OFFSET      (detector.mem + 0x00) /* 16 bits read */
-#define BOLTEK_DATA_WEST_OFFSET	      (detector.mem + 0x02) /* 16 bits read */
+static unsigned int sim_interval_ms;
+module_param(sim_interval_ms, uint, 0644);
+MODULE_PARM_DESC(sim_interval_ms, "Simulated detector triggers on its own "
+		 "every N ms, 0 (default) only on FORCE_TRIGGER");
 
-#define BOLTEK_SQUELCH_OFFSET	      (detector.mem + 0x00) /* 16 bits write */
-#define BOLTEK_FORCE_TRIGGER_OFFSET   (detector.mem + 0x02) /* 16 bits write */
-#define BOLTEK_RESET_TIMESTAMP_OFFSET (detector.mem + 0x04) /* 16 bits write */
+static unsigned int ring_entries = 64;
+module_param(ring_entries, uint, 0444);
+MODULE_PARM_DESC(ring_entries, "Captures queued in the driver before the "
+		 "oldest is overwritten (default 64, at most 4096)");
 
-#define BOLTEK_PLX_CONTROL	      (detector.ctl + 0x50) /* 32 bits read */
+#define BOLTEK_DATA_NORTH_OFFSET(dev)	   ((dev)->mem + 0x00) /* 16 bits read */
+#define BOLTEK_DATA_WEST_OFFSET(dev)	   ((dev)->mem + 0x02) /* 16 bits read */
+
+#define BOLTEK_SQUELCH_OFFSET(dev)	   ((dev)->mem + 0x00) /* 16 bits write */
+#define BOLTEK_FORCE_TRIGGER_OFFSET(dev)   ((dev)->mem + 0x02) /* 16 bits write */
+#define BOLTEK_RESET_TIMESTAMP_OFFSET(dev) ((dev)->mem + 0x04) /* 16 bits write */
+
+#define BOLTEK_PLX_INTCSR(dev)		   ((dev)->ctl + 0x4c) /* 32 bits read/write */
+#define BOLTEK_PLX_CONTROL(dev)		   ((dev)->ctl + 0x50) /* 32 bits read */
 
 #define BOLTEK_STRIKE_READY_BIT (1 << 2)
 #define BOLTEK_CLK_ENABLE_BIT	(1 << 8)
 
+#define BOLTEK_INTCSR_LINT1_ENABLE	(1 << 0)
+#define BOLTEK_INTCSR_LINT1_STATUS	(1 << 2)
+#define BOLTEK_INTCSR_PCI_INT_ENABLE	(1 << 6)
+
 #define BOLTEK_IOCTL_RESTART	   _IO(0xEA, 0xA0)
 #define BOLTEK_IOCTL_FORCE_TRIGGER _IO(0xEA, 0xA1)
 #define BOLTEK_IOCTL_STRIKE_READY  _IOR(0xEA, 0xA2, u8)
 #define BOLTEK_IOCTL_GET_DATA	   _IOR(0xEA, 0xA3, struct stormpci_packed_data)
 #define BOLTEK_IOCTL_SET_SQUELCH   _IOW(0xEA, 0xA4, u8)
 #define BOLTEK_IOCTL_GET_VERSION   _IOR(0xEA, 0xA5, u16)
+#define BOLTEK_IOCTL_GET_OVERRUNS  _IOR(0xEA, 0xA6, u32)
+#define BOLTEK_IOCTL_GET_DATA_AND_RESTART \
+	_IOR(0xEA, 0xA7, struct stormpci_capture)
+#define BOLTEK_IOCTL_SET_CURSOR	   _IOW(0xEA, 0xA8, u64)
 
 #define BOLTEK_BUFFERSIZE 512
 struct stormpci_packed_data {
@@ -49,19 +119,161 @@ struct stormpci_packed_data {
 	u16 usWest [BOLTEK_BUFFERSIZE];
 };
 
-static struct boltek_device {
-	struct cdev cdev;
-	struct class *class;
+/*
+ * What the driver knows about a capture besides its samples. seq
+ * numbers the captures since the device was first opened, starting at
+ * 1, and is 0 while the slot is being refilled. missed is how many
+ * captures were overwritten before this reader got to them, since its
+ * previous capture (always 0 in the ring itself). timestamp_ns is
+ * CLOCK_MONOTONIC when the FIFO was drained.
+ */
+struct stormpci_capture_info {
+	u64 seq;
+	s64 timestamp_ns;
+	u32 missed;
+	u32 reserved;
+};
+
+/* BOLTEK_IOCTL_GET_DATA_AND_RESTART */
+struct stormpci_capture {
+	struct stormpci_capture_info info;
+	struct stormpci_packed_data data;
+};
+
+/*
+ * The capture ring as seen through a read-only mmap(). The first page
+ * holds this header, the captures start at data_offset and their
+ * struct stormpci_capture_info at info_offset. The driver refills the
+ * slot at head, overwriting the oldest capture, then advances head
+ * (wrapping at entries) and sets seq. The capture with sequence number
+ * n is in slot (n - 1) % entries; a reader keeps its own cursor and
+ * checks the slot's info.seq before and after using it. Only read()
+ * and GET_DATA move the file's cursor in the driver, so before waiting
+ * in poll() a reader of the mapping hands its own to SET_CURSOR.
+ */
+#define BOLTEK_RING_VERSION 1
+#define BOLTEK_RING_MAX_ENTRIES 4096U	/* 8MB of captures per card */
+struct boltek_ring_header {
+	u32 version;
+	u32 entries;
+	u32 entry_size;
+	u32 data_offset;
+	u32 head;
+	u32 tail;		/* unused since ABI 6 */
+	u32 overruns;		/* unused since ABI 6, always 0 */
+	u32 info_offset;	/* ABI 5, entries stormpci_capture_info */
+	u32 seq;		/* ABI 6, low 32 bits of the newest seq */
+};
+
+/* an open file, every reader sees every capture */
+struct boltek_reader {
+	struct boltek_device *dev;
+	struct mutex mutex;	/* read() and GET_DATA on this file */
+	u64 next;		/* seq of the next capture to hand out */
+	u32 missed;		/* overwritten unread, since the last capture */
+	u32 lost;		/* the same since open, GET_OVERRUNS */
+};
+
+/*
+ * How long a lock was held, in ns. Updated just before the lock is
+ * dropped, so the lock itself protects them.
+ */
+struct boltek_hold_stats {
+	u64 count;
+	u64 total_ns;
+	u64 max_ns;
+};
+
+/*
+ * Activity counters and latency histograms, for sysfs. Updated from
+ * every reader at once, so they are atomics rather than covered by a
+ * lock. Histogram bucket n counts times of [2^n, 2^(n+1)) ns, the last
+ * one everything longer.
+ */
+#define BOLTEK_HIST_BUCKETS 32
+
+struct boltek_stats {
+	atomic_long_t triggers;		/* captures drained from the FIFO */
+	atomic_long_t reads;		/* handed out by read() and GET_DATA */
+	atomic_long_t restarts;		/* board re-armed */
+	atomic_long_t forced;		/* FORCE_TRIGGER */
+	atomic_long_t squelch;		/* SET_SQUELCH accepted */
+	atomic_long_t overruns;		/* overwritten before a reader got them */
+	atomic_t ioctl_ns[BOLTEK_HIST_BUCKETS];	/* ioctl service time */
+	atomic_t latency_ns[BOLTEK_HIST_BUCKETS];	/* drain to read */
+};
+
+/* one per card, or per simulated detector */
+struct boltek_device {
+	struct kref kref;	/* the card and each open file */
+	struct cdev *cdev;
+	int minor;
 	int opened;
-	int registered;
-	int major;
-	int active;
+	int active;	    /* cleared under fifo_mutex on removal */
 	void __iomem *ctl;  /* bar0 (also bar1 as io port) */
 	void __iomem *mem;  /* bar2 */
 	u16 squelch;
-}  detector;
 
-static DEFINE_SPINLOCK(boltek_lock);
+	struct pci_dev *pdev;
+	int irq;	    /* 0 when strike ready is polled from poll_timer */
+	int simulated;
+
+	/*
+	 * irq_lock protects strike_pending, sim_data and the INTCSR
+	 * register, which are also touched from interrupt and timer
+	 * context. It nests inside lock.
+	 */
+	spinlock_t irq_lock;
+	int strike_pending; /* triggered since the last restart */
+	wait_queue_head_t waitq;
+	struct timer_list poll_timer;
+	struct timer_list sim_timer;
+	struct stormpci_packed_data sim_data;
+
+	/*
+	 * Captures drained from the FIFO, shared with userspace through
+	 * mmap(). The drain is the only producer and never waits for a
+	 * reader: it overwrites the oldest capture, and readers that fall
+	 * that far behind skip ahead. lock covers seq, ring_head and
+	 * opened, and is never held across PCI reads or user copies.
+	 * ring_head is the slot the drain fills next; the header's head
+	 * is only a copy for userspace and never read back, so what a
+	 * mapping holds can't steer the drain outside the ring.
+	 */
+	spinlock_t lock;
+	struct work_struct drain_work;
+	struct boltek_ring_header *ring_hdr;	/* vmalloc_user() */
+	struct stormpci_packed_data *ring;	/* slot 0 */
+	struct stormpci_capture_info *ring_info;	/* one per slot */
+	unsigned int ring_size;
+	unsigned int ring_head;
+	unsigned long ring_bytes;
+	u64 seq;		/* of the newest capture */
+
+	/*
+	 * fifo_mutex serializes the FIFO drain and everything else that
+	 * touches the board: restarts, squelch and forced triggers. It
+	 * is taken outside lock.
+	 */
+	struct mutex fifo_mutex;
+	struct file *squelch_owner;	/* under fifo_mutex */
+
+	u64 lock_since;		/* lock taken, local_clock() */
+	u64 fifo_since;
+	struct boltek_hold_stats lock_hold;
+	struct boltek_hold_stats fifo_hold;
+	struct boltek_stats stats;
+};
+
+#define BOLTEK_MAX_CARDS 8
+
+static struct class *boltek_class;
+static int boltek_major = -1;
+static int boltek_registered;
+
+/* minor number to card, boltek_cards_mutex covers lookups from open() */
+static DEFINE_MUTEX(boltek_cards_mutex);
+static struct boltek_device *boltek_cards[BOLTEK_MAX_CARDS];
 
 static struct pci_device_id boltek_pci_tbl[] __devinitdata = {
 	{
@@ -84,6 +296,11 @@ static int boltek_open(struct inode *inode, struct file *file);
 static long boltek_unlocked_ioctl(struct file *file, unsigned int cmd,
 				  unsigned long arg);
 static int boltek_release(struct inode *inode, struct file *file);
+static unsigned int boltek_poll(struct file *file, poll_table *wait);
+static ssize_t boltek_read(struct file *file, char __user *buf, size_t count,
+			   loff_t *ppos);
+static int boltek_mmap(struct file *file, struct vm_area_struct *vma);
+static void boltek_put(struct boltek_device *dev);
 
 static struct pci_driver boltek_pci_driver = {
 	.name = "boltek",
@@ -96,109 +313,658 @@ static struct file_operations boltek_file_ops = {
 	.open =	   boltek_open,
 	.release = boltek_release,
 	.unlocked_ioctl = boltek_unlocked_ioctl,
+	.poll =	   boltek_poll,
+	.read =	   boltek_read,
+	.mmap =	   boltek_mmap,
 	/* .compat_ioctl is not needed, because there are no variable sized
 	   types are part of the api */
 };
 
 
-/* call with lock held */
-static void boltek_restartboard_l(void)
+static void boltek_hold_account(struct boltek_hold_stats *st, u64 since)
+{
+	u64 held = local_clock() - since;
+
+	st->count++;
+	st->total_ns += held;
+	if (held > st->max_ns)
+		st->max_ns = held;
+}
+
+static void boltek_hist_add(atomic_t *hist, s64 ns)
+{
+	int n = ns > 0 ? fls64(ns) - 1 : 0;
+
+	atomic_inc(&hist[min(n, BOLTEK_HIST_BUCKETS - 1)]);
+}
+
+/* dev->lock, timing how long it is held */
+static void boltek_spin_lock(struct boltek_device *dev)
+{
+	spin_lock(&dev->lock);
+	dev->lock_since = local_clock();
+}
+
+static void boltek_spin_unlock(struct boltek_device *dev)
+{
+	boltek_hold_account(&dev->lock_hold, dev->lock_since);
+	spin_unlock(&dev->lock);
+}
+
+static void boltek_fifo_lock(struct boltek_device *dev)
+{
+	mutex_lock(&dev->fifo_mutex);
+	dev->fifo_since = local_clock();
+}
+
+static void boltek_fifo_unlock(struct boltek_device *dev)
+{
+	boltek_hold_account(&dev->fifo_hold, dev->fifo_since);
+	mutex_unlock(&dev->fifo_mutex);
+}
+
+/*
+ * A simulated strike: a damped oscillation from a random bearing,
+ * with the E-field bit following the polarity of the wave.
+ * Call with irq_lock held.
+ */
+static void boltek_sim_fill_l(struct boltek_device *dev)
+{
+	static const s8 wave[32] = {
+		0, 25, 49, 71, 90, 106, 117, 125,
+		127, 125, 117, 106, 90, 71, 49, 25,
+		0, -25, -49, -71, -90, -106, -117, -125,
+		-127, -125, -117, -106, -90, -71, -49, -25
+	};
+	int cnt, amp, gain_n, gain_e, n, e, w;
+	u32 rnd;
+
+	get_random_bytes(&rnd, sizeof(rnd));
+	gain_n = wave[rnd & 31];	/* sin and cos of the bearing */
+	gain_e = wave[(rnd + 8) & 31];
+
+	for (cnt = 0; cnt < BOLTEK_BUFFERSIZE; cnt++) {
+		/* 128 sample period, decaying to nothing by the end */
+		w = wave[(cnt >> 2) & 31];
+		amp = 120 * (BOLTEK_BUFFERSIZE - cnt) / BOLTEK_BUFFERSIZE;
+		n = 128 + w * amp * gain_n / (127 * 127);
+		e = 128 + w * amp * gain_e / (127 * 127);
+
+		/* E-field leads the H-field by 10 samples */
+		dev->sim_data.usNorth[cnt] = n |
+			((wave[((cnt + 10) >> 2) & 31] >= 0) ? 0x100 : 0);
+		dev->sim_data.usWest[cnt] = e;
+	}
+}
+
+/* a strike is waiting to be read */
+static int boltek_strike_ready(struct boltek_device *dev)
+{
+	if (dev->simulated)
+		return dev->strike_pending;
+
+	/* when the control bit 2 is _off_ there is strike data ready */
+	return !(ioread32(BOLTEK_PLX_CONTROL(dev)) & BOLTEK_STRIKE_READY_BIT);
+}
+
+/* note a strike and have it drained into the ring. Takes irq_lock */
+static void boltek_strike_signal(struct boltek_device *dev)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&dev->irq_lock, flags);
+	if (dev->simulated && !dev->strike_pending)
+		boltek_sim_fill_l(dev);
+	dev->strike_pending = 1;
+	spin_unlock_irqrestore(&dev->irq_lock, flags);
+
+	trace_boltek_trigger(dev->minor, dev->seq + 1, dev->squelch);
+	schedule_work(&dev->drain_work);
+}
+
+/* a capture the reader hasn't seen is queued, without taking any lock */
+static int boltek_ring_ready(struct boltek_reader *rd)
+{
+	return ACCESS_ONCE(rd->dev->ring_hdr->seq) != (u32)(rd->next - 1);
+}
+
+/* the slot the capture numbered seq lives in */
+static unsigned int boltek_ring_slot(struct boltek_device *dev, u64 seq)
+{
+	seq--;
+	return do_div(seq, dev->ring_size);
+}
+
+/* call with fifo_mutex held */
+static void boltek_read_fifo_l(struct boltek_device *dev,
+			       struct stormpci_packed_data *nv)
+{
+	unsigned long flags;
+
+	if (dev->simulated) {
+		spin_lock_irqsave(&dev->irq_lock, flags);
+		memcpy(nv, &dev->sim_data, sizeof(*nv));
+		spin_unlock_irqrestore(&dev->irq_lock, flags);
+		return;
+	}
+
+	/* Read N FIFO, E-Field on D8 */
+	ioread16_rep(BOLTEK_DATA_NORTH_OFFSET(dev), nv->usNorth, BOLTEK_BUFFERSIZE);
+
+	/* Read W FIFO, GPS on D8-15 */
+	ioread16_rep(BOLTEK_DATA_WEST_OFFSET(dev), nv->usWest, BOLTEK_BUFFERSIZE);
+}
+
+static irqreturn_t boltek_interrupt(int irq, void *dev_id)
+{
+	struct boltek_device *dev = dev_id;
+	u32 intcsr;
+
+	spin_lock(&dev->irq_lock);
+	intcsr = ioread32(BOLTEK_PLX_INTCSR(dev));
+	if (!(intcsr & BOLTEK_INTCSR_LINT1_ENABLE) ||
+	    !(intcsr & BOLTEK_INTCSR_LINT1_STATUS)) {
+		/* shared line, not ours */
+		spin_unlock(&dev->irq_lock);
+		return IRQ_NONE;
+	}
+
+	/* LINTi1 stays asserted until the board is restarted, so mask it */
+	iowrite32(intcsr & ~BOLTEK_INTCSR_LINT1_ENABLE, BOLTEK_PLX_INTCSR(dev));
+	dev->strike_pending = 1;
+	spin_unlock(&dev->irq_lock);
+
+	trace_boltek_trigger(dev->minor, dev->seq + 1, dev->squelch);
+	schedule_work(&dev->drain_work);
+	return IRQ_HANDLED;
+}
+
+static unsigned long boltek_poll_interval(void)
+{
+	unsigned long j = msecs_to_jiffies(poll_ms);
+
+	return j ? j : 1;
+}
+
+/* stand-in for the interrupt when there isn't one */
+static void boltek_poll_timer(unsigned long data)
+{
+	struct boltek_device *dev = (struct boltek_device *)data;
+
+	if (boltek_strike_ready(dev))
+		boltek_strike_signal(dev);
+	else if (dev->opened && dev->active)
+		mod_timer(&dev->poll_timer, jiffies + boltek_poll_interval());
+}
+
+static void boltek_sim_timer(unsigned long data)
+{
+	struct boltek_device *dev = (struct boltek_device *)data;
+
+	if (sim_interval_ms && dev->opened && dev->active) {
+		boltek_strike_signal(dev);
+		mod_timer(&dev->sim_timer,
+			  jiffies + msecs_to_jiffies(sim_interval_ms));
+	}
+}
+
+/* wait for the next trigger, called after the board is restarted */
+static void boltek_arm(struct boltek_device *dev)
+{
+	unsigned long flags;
+	u32 intcsr;
+
+	spin_lock_irqsave(&dev->irq_lock, flags);
+	dev->strike_pending = 0;
+	if (dev->irq) {
+		intcsr = ioread32(BOLTEK_PLX_INTCSR(dev));
+		intcsr |= BOLTEK_INTCSR_LINT1_ENABLE |
+			BOLTEK_INTCSR_PCI_INT_ENABLE;
+		iowrite32(intcsr, BOLTEK_PLX_INTCSR(dev));
+	}
+	spin_unlock_irqrestore(&dev->irq_lock, flags);
+
+	if (!dev->irq && !dev->simulated)
+		mod_timer(&dev->poll_timer, jiffies + boltek_poll_interval());
+	trace_boltek_rearm(dev->minor, dev->seq, dev->squelch);
+}
+
+/*
+ * stop waiting for triggers, the device is being closed. Call with
+ * fifo_mutex held, so an open can't arm the board in between and a
+ * hot-remove can't unmap it; a queued drain is left to the caller, it
+ * takes fifo_mutex itself
+ */
+static void boltek_disarm_l(struct boltek_device *dev)
+{
+	unsigned long flags;
+
+	if (dev->irq && dev->ctl) {
+		spin_lock_irqsave(&dev->irq_lock, flags);
+		iowrite32(ioread32(BOLTEK_PLX_INTCSR(dev)) &
+			  ~BOLTEK_INTCSR_LINT1_ENABLE, BOLTEK_PLX_INTCSR(dev));
+		spin_unlock_irqrestore(&dev->irq_lock, flags);
+	}
+	del_timer_sync(&dev->poll_timer);
+	del_timer_sync(&dev->sim_timer);
+}
+
+static void boltek_disarm(struct boltek_device *dev)
+{
+	boltek_fifo_lock(dev);
+	boltek_disarm_l(dev);
+	boltek_fifo_unlock(dev);
+	cancel_work_sync(&dev->drain_work);
+}
+
+/* call with fifo_mutex held */
+static void boltek_restartboard_l(struct boltek_device *dev)
 {
 	/* Stop adc Clock so FIFO will reset */
 	u32  data;
 
+	atomic_long_inc(&dev->stats.restarts);
+	if (dev->simulated) {
+		boltek_arm(dev);
+		return;
+	}
+
 	/* clear clock enable */
-	data = ioread32(BOLTEK_PLX_CONTROL);
+	data = ioread32(BOLTEK_PLX_CONTROL(dev));
 	data &= ~BOLTEK_CLK_ENABLE_BIT;
-	iowrite32(data, BOLTEK_PLX_CONTROL);
+	iowrite32(data, BOLTEK_PLX_CONTROL(dev));
 
 	/* update squelch */
-	iowrite16(detector.squelch, BOLTEK_SQUELCH_OFFSET);
+	iowrite16(dev->squelch, BOLTEK_SQUELCH_OFFSET(dev));
 
 	/* set clock enable */
-	data = ioread32(BOLTEK_PLX_CONTROL);
+	data = ioread32(BOLTEK_PLX_CONTROL(dev));
 	data |= BOLTEK_CLK_ENABLE_BIT;
-	iowrite32(data, BOLTEK_PLX_CONTROL);
+	iowrite32(data, BOLTEK_PLX_CONTROL(dev));
 
+	boltek_arm(dev);
 	return;
 }
 
+/*
+ * Move a triggered capture from the FIFO into the ring and re-arm the
+ * board straight away, so the dead time between strikes no longer
+ * depends on when userspace gets around to it.
+ */
+static void boltek_drain_work(struct work_struct *work)
+{
+	struct boltek_device *dev =
+		container_of(work, struct boltek_device, drain_work);
+	struct stormpci_capture_info *info;
+	unsigned int head;
+
+	boltek_fifo_lock(dev);
+	if (!dev->opened || !dev->active || !boltek_strike_ready(dev)) {
+		boltek_fifo_unlock(dev);
+		return;
+	}
+
+	/*
+	 * Only the drain writes head and seq, and fifo_mutex keeps it to
+	 * one at a time, so the slot can be filled unlocked. Readers
+	 * still using the capture it held see its seq change.
+	 */
+	trace_boltek_drain_start(dev->minor, dev->seq + 1, dev->squelch);
+	head = dev->ring_head;
+	info = &dev->ring_info[head];
+	info->seq = 0;
+	smp_wmb();
+	info->timestamp_ns = ktime_to_ns(ktime_get());
+	info->missed = 0;
+	info->reserved = 0;
+	boltek_read_fifo_l(dev, &dev->ring[head]);
+	/* publish the capture before its seq, and both before head */
+	smp_wmb();
+	info->seq = dev->seq + 1;
+	smp_wmb();
+
+	boltek_spin_lock(dev);
+	dev->seq++;
+	atomic_long_inc(&dev->stats.triggers);
+	dev->ring_head = (head + 1) % dev->ring_size;
+	dev->ring_hdr->head = dev->ring_head;
+	dev->ring_hdr->seq = (u32)dev->seq;
+	boltek_spin_unlock(dev);
+	trace_boltek_drain_end(dev->minor, dev->seq, dev->squelch);
+
+	boltek_restartboard_l(dev);
+	boltek_fifo_unlock(dev);
+
+	wake_up_interruptible(&dev->waitq);
+}
+
 static int boltek_release(struct inode *inode, struct file *file)
 {
-	spin_lock(&boltek_lock);
-	detector.opened--;
-	WARN_ON(detector.opened);
-	spin_unlock(&boltek_lock);
+	struct boltek_reader *rd = file->private_data;
+	struct boltek_device *dev = rd->dev;
+	int last;
+
+	/* under fifo_mutex, as open, so a first open can't slip in
+	   between the last close and the disarm */
+	boltek_fifo_lock(dev);
+	if (dev->squelch_owner == file)
+		dev->squelch_owner = NULL;
+	boltek_spin_lock(dev);
+	last = --dev->opened == 0;
+	boltek_spin_unlock(dev);
+	if (last)
+		boltek_disarm_l(dev);
+	boltek_fifo_unlock(dev);
+
+	if (last) {
+		cancel_work_sync(&dev->drain_work);
+		/* an open since may have had its first drain cancelled */
+		if (ACCESS_ONCE(dev->opened))
+			schedule_work(&dev->drain_work);
+	}
+	kfree(rd);
+	boltek_put(dev);
 	return 0;
 }
 
+/*
+ * Any number of readers may have a card open. The first one starts
+ * acquisition, later ones only get a cursor starting at the next
+ * capture, so they cost the others nothing. Each card is independent.
+ */
 static int boltek_open(struct inode *inode, struct file *file)
 {
-	int rv = 0;
+	struct boltek_device *dev = NULL;
+	struct boltek_reader *rd;
+	int rv = 0, first = 0;
+
+	mutex_lock(&boltek_cards_mutex);
+	if (iminor(inode) < BOLTEK_MAX_CARDS)
+		dev = boltek_cards[iminor(inode)];
+	if (dev)
+		kref_get(&dev->kref);
+	mutex_unlock(&boltek_cards_mutex);
+	if (dev == NULL)
+		return -ENODEV;
+
+	rd = kzalloc(sizeof(*rd), GFP_KERNEL);
+	if (rd == NULL) {
+		boltek_put(dev);
+		return -ENOMEM;
+	}
+	rd->dev = dev;
+	mutex_init(&rd->mutex);
 
-	spin_lock(&boltek_lock);
+	boltek_fifo_lock(dev);
+	boltek_spin_lock(dev);
 
-	if (detector.active == 0)
+	if (dev->active == 0)
 		rv = -EINVAL;
-	else if (detector.opened)
-		rv = -EACCES;
 	else {
-		detector.opened++;
-		iowrite16(0, BOLTEK_RESET_TIMESTAMP_OFFSET);
-		boltek_restartboard_l();
+		first = dev->opened++ == 0;
+		if (first) {
+			dev->ring_head = 0;
+			dev->ring_hdr->head = 0;
+			dev->ring_hdr->tail = 0;
+			dev->ring_hdr->overruns = 0;
+			dev->ring_hdr->seq = 0;
+			dev->seq = 0;
+		}
+		rd->next = dev->seq + 1;
 	}
-	spin_unlock(&boltek_lock);
+	boltek_spin_unlock(dev);
+
+	if (first) {
+		memset(dev->ring_info, 0, dev->ring_size *
+		       sizeof(struct stormpci_capture_info));
+		if (!dev->simulated)
+			iowrite16(0, BOLTEK_RESET_TIMESTAMP_OFFSET(dev));
+		boltek_restartboard_l(dev);
+		if (dev->simulated && sim_interval_ms)
+			mod_timer(&dev->sim_timer,
+				  jiffies + msecs_to_jiffies(sim_interval_ms));
+	}
+	boltek_fifo_unlock(dev);
 
-	return rv;
+	if (rv) {
+		kfree(rd);
+		boltek_put(dev);
+		return rv;
+	}
+	file->private_data = rd;
+	return 0;
+}
+
+static unsigned int boltek_poll(struct file *file, poll_table *wait)
+{
+	struct boltek_reader *rd = file->private_data;
+	unsigned int mask = 0;
+
+	poll_wait(file, &rd->dev->waitq, wait);
+	if (boltek_ring_ready(rd))
+		mask |= POLLIN | POLLRDNORM;
+	return mask;
+}
+
+/*
+ * Copy the reader's next capture to userspace, call with rd->mutex
+ * held. With info, buf is a struct stormpci_capture, otherwise just
+ * the struct stormpci_packed_data. Captures overwritten before the
+ * reader got to them are skipped and counted. 1 if a capture was
+ * copied, 0 if the reader is up to date.
+ */
+static int boltek_consume(struct boltek_reader *rd, void __user *buf,
+			  int info)
+{
+	struct boltek_device *dev = rd->dev;
+	struct stormpci_capture_info ci;
+	unsigned int slot;
+	u64 newest, oldest;
+
+	for (;;) {
+		boltek_spin_lock(dev);
+		newest = dev->seq;
+		boltek_spin_unlock(dev);
+		if (rd->next > newest)
+			return 0;
+
+		/* the slot at head may be being refilled already */
+		oldest = newest > dev->ring_size - 2 ?
+			newest - (dev->ring_size - 2) : 1;
+		if (rd->next < oldest) {
+			rd->missed += oldest - rd->next;
+			rd->lost += oldest - rd->next;
+			atomic_long_add(oldest - rd->next,
+					&dev->stats.overruns);
+			rd->next = oldest;
+		}
+
+		slot = boltek_ring_slot(dev, rd->next);
+		ci = dev->ring_info[slot];
+		smp_rmb();
+		if (ci.seq == rd->next) {
+			if (copy_to_user(info ? buf +
+					 offsetof(struct stormpci_capture, data) :
+					 buf, &dev->ring[slot],
+					 sizeof(struct stormpci_packed_data)))
+				return -EFAULT;
+			/* still the same capture after the copy? */
+			smp_rmb();
+			if (ACCESS_ONCE(dev->ring_info[slot].seq) == rd->next)
+				break;
+		}
+		/* overwritten under us, skip ahead */
+	}
+
+	if (info) {
+		ci.missed = rd->missed;
+		if (copy_to_user(buf, &ci, sizeof(ci)))
+			return -EFAULT;
+	}
+	trace_boltek_copy_to_user(dev->minor, rd->next, dev->squelch);
+	rd->missed = 0;
+	rd->next++;
+	atomic_long_inc(&dev->stats.reads);
+	boltek_hist_add(dev->stats.latency_ns,
+			ktime_to_ns(ktime_get()) - ci.timestamp_ns);
+	return 1;
+}
+
+/*
+ * read() returns whole struct stormpci_packed_data captures, as many
+ * as fit in count. It blocks until at least one is queued unless the
+ * file is O_NONBLOCK.
+ */
+static ssize_t boltek_read(struct file *file, char __user *buf, size_t count,
+			   loff_t *ppos)
+{
+	struct boltek_reader *rd = file->private_data;
+	const size_t size = sizeof(struct stormpci_packed_data);
+	ssize_t copied = 0;
+	int rv;
+
+	if (count < size)
+		return -EINVAL;
+
+	if (mutex_lock_interruptible(&rd->mutex))
+		return -ERESTARTSYS;
+
+	while (!boltek_ring_ready(rd)) {
+		mutex_unlock(&rd->mutex);
+		if (file->f_flags & O_NONBLOCK)
+			return -EAGAIN;
+		if (wait_event_interruptible(rd->dev->waitq,
+					     boltek_ring_ready(rd)))
+			return -ERESTARTSYS;
+		if (mutex_lock_interruptible(&rd->mutex))
+			return -ERESTARTSYS;
+	}
+
+	while (count - copied >= size) {
+		rv = boltek_consume(rd, buf + copied, 0);
+		if (rv <= 0) {
+			if (!copied)
+				copied = rv;
+			break;
+		}
+		copied += size;
+	}
+	mutex_unlock(&rd->mutex);
+	return copied;
+}
+
+/*
+ * BOLTEK_IOCTL_GET_DATA: the reader's next capture. The board has been
+ * re-armed since it was drained, so GET_DATA_AND_RESTART is the same
+ * with the capture info in front.
+ */
+static long boltek_get_data(struct boltek_reader *rd, void __user *argp,
+			    int info)
+{
+	int rv;
+
+	if (mutex_lock_interruptible(&rd->mutex))
+		return -ERESTARTSYS;
+	rv = boltek_consume(rd, argp, info);
+	mutex_unlock(&rd->mutex);
+
+	if (rv < 0)
+		return rv;
+	return rv ? 0 : -EAGAIN;
+}
+
+/*
+ * BOLTEK_IOCTL_SET_CURSOR: seq of the next capture a reader of the
+ * mapping wants, so poll() and STRIKE_READY answer for it. It can't
+ * be past the capture the drain fills next; one already overwritten
+ * is skipped and counted by the next read() or GET_DATA as usual.
+ */
+static long boltek_set_cursor(struct boltek_reader *rd, void __user *argp)
+{
+	struct boltek_device *dev = rd->dev;
+	u64 nv, newest;
+
+	if (copy_from_user(&nv, argp, sizeof(nv)))
+		return -EFAULT;
+	if (nv == 0)
+		return -EINVAL;
+
+	if (mutex_lock_interruptible(&rd->mutex))
+		return -ERESTARTSYS;
+	boltek_spin_lock(dev);
+	newest = dev->seq;
+	boltek_spin_unlock(dev);
+	rd->next = min(nv, newest + 1);
+	rd->missed = 0;
+	mutex_unlock(&rd->mutex);
+	return 0;
+}
+
+/*
+ * map the capture ring, header page first, for zero-copy readers.
+ * Read-only, as every reader shares it
+ */
+static int boltek_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct boltek_reader *rd = file->private_data;
+
+	if (vma->vm_pgoff != 0 ||
+	    vma->vm_end - vma->vm_start > rd->dev->ring_bytes)
+		return -EINVAL;
+	if (vma->vm_flags & VM_WRITE)
+		return -EPERM;
+	vma->vm_flags &= ~VM_MAYWRITE;
+
+	return remap_vmalloc_range(vma, rd->dev->ring_hdr, 0);
 }
 
 static long boltek_unlocked_ioctl(struct file *file, unsigned int cmd,
 				  unsigned long arg)
 {
+	struct boltek_reader *rd = file->private_data;
+	struct boltek_device *dev = rd->dev;
 	void __user *argp = (void __user *)arg;
+	u64 start = local_clock();
 	int rv = 0;
 
-	spin_lock(&boltek_lock);
-
+	/*
+	 * Each command takes only the locks it needs, and none is held
+	 * across a user copy.
+	 */
 	switch (cmd) {
-	case BOLTEK_IOCTL_RESTART:
-		boltek_restartboard_l();
+	case BOLTEK_IOCTL_GET_DATA:
+		rv = boltek_get_data(rd, argp, 0);
 		break;
 
-	case BOLTEK_IOCTL_FORCE_TRIGGER:
-		iowrite16(0, BOLTEK_FORCE_TRIGGER_OFFSET);
+	case BOLTEK_IOCTL_GET_DATA_AND_RESTART:
+		rv = boltek_get_data(rd, argp, 1);
 		break;
 
-	case BOLTEK_IOCTL_STRIKE_READY: {
-		u32 data;
-		u8 nv;
-
-		/* when the control bit 2 is _off_ there is strike data ready */
-
-		data = ioread32(BOLTEK_PLX_CONTROL);
-		nv = (!(data & BOLTEK_STRIKE_READY_BIT)) ? 1 : 0;
-		if (copy_to_user(argp, &nv, sizeof(nv))) {
-			rv = -EFAULT;
-			break;
-		}
-	}
+	case BOLTEK_IOCTL_SET_CURSOR:
+		rv = boltek_set_cursor(rd, argp);
 		break;
 
-	case BOLTEK_IOCTL_GET_DATA:  {
-		struct stormpci_packed_data nv;
-		u16 cnt;
+	case BOLTEK_IOCTL_RESTART:
+		/* the board is re-armed as soon as a capture is drained */
+		break;
 
-		/*
-		 * store data if there is room in the capture buffer
-		 * Read N FIFO, E-Field on D8
-		 */
-		for (cnt = 0; cnt < BOLTEK_BUFFERSIZE; cnt++)
-			nv.usNorth[cnt] = ioread16(BOLTEK_DATA_NORTH_OFFSET);
+	case BOLTEK_IOCTL_FORCE_TRIGGER:
+		boltek_fifo_lock(dev);
+		if (!dev->active)
+			rv = -ENODEV;
+		else if (dev->simulated)
+			boltek_strike_signal(dev);
+		else
+			iowrite16(0, BOLTEK_FORCE_TRIGGER_OFFSET(dev));
+		if (dev->active)
+			atomic_long_inc(&dev->stats.forced);
+		boltek_fifo_unlock(dev);
+		break;
 
-		/* Read W FIFO, GPS on D8-15 */
-		for (cnt = 0; cnt < BOLTEK_BUFFERSIZE; cnt++)
-			nv.usWest[cnt] = ioread16(BOLTEK_DATA_WEST_OFFSET);
+	case BOLTEK_IOCTL_STRIKE_READY: {
+		u8 nv;
 
+		nv = boltek_ring_ready(rd) ? 1 : 0;
 		if (copy_to_user(argp, &nv, sizeof(nv))) {
 			rv = -EFAULT;
 			break;
@@ -214,9 +980,24 @@ static long boltek_unlocked_ioctl(struct file *file, unsigned int cmd,
 			break;
 		}
 
-		if (nv <= 15)
-			detector.squelch = nv;
-		else {
+		if (nv <= 15) {
+			/* takes effect at once, at the cost of a capture
+			   that may be sitting undrained in the FIFO. The
+			   first reader to set it keeps it to itself */
+			boltek_fifo_lock(dev);
+			if (!dev->active) {
+				rv = -ENODEV;
+			} else if (dev->squelch_owner &&
+			    dev->squelch_owner != file) {
+				rv = -EBUSY;
+			} else {
+				dev->squelch_owner = file;
+				dev->squelch = nv;
+				atomic_long_inc(&dev->stats.squelch);
+				boltek_restartboard_l(dev);
+			}
+			boltek_fifo_unlock(dev);
+		} else {
 			printk(KERN_INFO
 			       "IOCTL for boltek set squelch out of range\n");
 			rv = -EINVAL;
@@ -233,30 +1014,280 @@ static long boltek_unlocked_ioctl(struct file *file, unsigned int cmd,
 	}
 		break;
 
+	case BOLTEK_IOCTL_GET_OVERRUNS: {
+		/* captures this reader lost to overwriting */
+		u32 nv = ACCESS_ONCE(rd->lost);
+
+		if (copy_to_user(argp, &nv, sizeof(nv))) {
+			rv = -EFAULT;
+			break;
+		}
+	}
+		break;
+
 	default:
 		rv = -EINVAL;
 		break;
 	}
-	spin_unlock(&boltek_lock);
+	boltek_hist_add(dev->stats.ioctl_ns, local_clock() - start);
 	return rv;
 }
 
+/*
+ * sysfs: lock_hold and fifo_hold report how often and how long the
+ * card's ring lock and fifo_mutex were held, as "count total_ns max_ns".
+ * The attributes exist before boltek_register() sets the drvdata, a
+ * read in between gets -ENODEV
+ */
+static ssize_t boltek_show_lock_hold(struct device *d,
+				     struct device_attribute *attr, char *buf)
+{
+	struct boltek_device *dev = dev_get_drvdata(d);
+	struct boltek_hold_stats st;
+
+	if (dev == NULL)
+		return -ENODEV;
+	/* not boltek_spin_lock(), reading the stats shouldn't skew them */
+	spin_lock(&dev->lock);
+	st = dev->lock_hold;
+	spin_unlock(&dev->lock);
+	return sprintf(buf, "%llu %llu %llu\n",
+		       (unsigned long long)st.count,
+		       (unsigned long long)st.total_ns,
+		       (unsigned long long)st.max_ns);
+}
+
+static ssize_t boltek_show_fifo_hold(struct device *d,
+				     struct device_attribute *attr, char *buf)
+{
+	struct boltek_device *dev = dev_get_drvdata(d);
+	struct boltek_hold_stats st;
+
+	if (dev == NULL)
+		return -ENODEV;
+	mutex_lock(&dev->fifo_mutex);
+	st = dev->fifo_hold;
+	mutex_unlock(&dev->fifo_mutex);
+	return sprintf(buf, "%llu %llu %llu\n",
+		       (unsigned long long)st.count,
+		       (unsigned long long)st.total_ns,
+		       (unsigned long long)st.max_ns);
+}
+
+/* stats: one "name count" line per counter */
+static ssize_t boltek_show_stats(struct device *d,
+				 struct device_attribute *attr, char *buf)
+{
+	struct boltek_device *dev = dev_get_drvdata(d);
+	struct boltek_stats *st;
+
+	if (dev == NULL)
+		return -ENODEV;
+	st = &dev->stats;
+	return sprintf(buf,
+		       "triggers %lu\nreads %lu\nrestarts %lu\n"
+		       "forced_triggers %lu\nsquelch_changes %lu\n"
+		       "overruns %lu\n",
+		       atomic_long_read(&st->triggers),
+		       atomic_long_read(&st->reads),
+		       atomic_long_read(&st->restarts),
+		       atomic_long_read(&st->forced),
+		       atomic_long_read(&st->squelch),
+		       atomic_long_read(&st->overruns));
+}
+
+/* a "lower_bound_ns count" line per non-empty bucket */
+static ssize_t boltek_show_hist(atomic_t *hist, char *buf)
+{
+	ssize_t len = 0;
+	int n, count;
+
+	for (n = 0; n < BOLTEK_HIST_BUCKETS; n++) {
+		count = atomic_read(&hist[n]);
+		if (count)
+			len += sprintf(buf + len, "%llu %d\n",
+				       n ? 1ULL << n : 0ULL, count);
+	}
+	return len;
+}
+
+static ssize_t boltek_show_ioctl_hist(struct device *d,
+				      struct device_attribute *attr, char *buf)
+{
+	struct boltek_device *dev = dev_get_drvdata(d);
+
+	if (dev == NULL)
+		return -ENODEV;
+	return boltek_show_hist(dev->stats.ioctl_ns, buf);
+}
+
+static ssize_t boltek_show_latency_hist(struct device *d,
+					struct device_attribute *attr,
+					char *buf)
+{
+	struct boltek_device *dev = dev_get_drvdata(d);
+
+	if (dev == NULL)
+		return -ENODEV;
+	return boltek_show_hist(dev->stats.latency_ns, buf);
+}
+
+static struct device_attribute boltek_dev_attrs[] = {
+	__ATTR(lock_hold, 0444, boltek_show_lock_hold, NULL),
+	__ATTR(fifo_hold, 0444, boltek_show_fifo_hold, NULL),
+	__ATTR(stats, 0444, boltek_show_stats, NULL),
+	__ATTR(ioctl_hist, 0444, boltek_show_ioctl_hist, NULL),
+	__ATTR(latency_hist, 0444, boltek_show_latency_hist, NULL),
+	__ATTR_NULL
+};
+
+/*
+ * A detector and its capture ring, not yet visible to userspace. The
+ * caller fills in the card details and calls boltek_register().
+ */
+static struct boltek_device *boltek_alloc(void)
+{
+	struct boltek_device *dev;
+
+	dev = kzalloc(sizeof(*dev), GFP_KERNEL);
+	if (dev == NULL)
+		return NULL;
+
+	kref_init(&dev->kref);
+	dev->minor = -1;
+	spin_lock_init(&dev->lock);
+	spin_lock_init(&dev->irq_lock);
+	init_waitqueue_head(&dev->waitq);
+	setup_timer(&dev->poll_timer, boltek_poll_timer, (unsigned long)dev);
+	setup_timer(&dev->sim_timer, boltek_sim_timer, (unsigned long)dev);
+	INIT_WORK(&dev->drain_work, boltek_drain_work);
+	mutex_init(&dev->fifo_mutex);
+
+	/* one slot always stays empty */
+	dev->ring_size = clamp(ring_entries, 1U, BOLTEK_RING_MAX_ENTRIES) + 1;
+	dev->ring_bytes = PAGE_ALIGN(PAGE_SIZE + dev->ring_size *
+				     (sizeof(struct stormpci_packed_data) +
+				      sizeof(struct stormpci_capture_info)));
+	dev->ring_hdr = vmalloc_user(dev->ring_bytes);
+	if (dev->ring_hdr == NULL) {
+		printk(KERN_INFO
+		       "boltek capture ring allocation failed\n");
+		kfree(dev);
+		return NULL;
+	}
+	dev->ring = (void *)dev->ring_hdr + PAGE_SIZE;
+	dev->ring_info = (void *)(dev->ring + dev->ring_size);
+	dev->ring_hdr->version = BOLTEK_RING_VERSION;
+	dev->ring_hdr->entries = dev->ring_size;
+	dev->ring_hdr->entry_size = sizeof(struct stormpci_packed_data);
+	dev->ring_hdr->data_offset = PAGE_SIZE;
+	dev->ring_hdr->info_offset = (void *)dev->ring_info -
+		(void *)dev->ring_hdr;
+	return dev;
+}
+
+static void boltek_free(struct kref *kref)
+{
+	struct boltek_device *dev =
+		container_of(kref, struct boltek_device, kref);
+
+	vfree(dev->ring_hdr);
+	kfree(dev);
+}
+
+static void boltek_put(struct boltek_device *dev)
+{
+	kref_put(&dev->kref, boltek_free);
+}
+
+/* give the detector the first free minor and its /dev/lightning-N */
+static int boltek_register(struct boltek_device *dev, struct device *parent)
+{
+	struct device *sysdev;
+	int minor, rv;
+
+	mutex_lock(&boltek_cards_mutex);
+	for (minor = 0; minor < BOLTEK_MAX_CARDS; minor++)
+		if (boltek_cards[minor] == NULL)
+			break;
+	if (minor == BOLTEK_MAX_CARDS) {
+		mutex_unlock(&boltek_cards_mutex);
+		return -ENOSPC;
+	}
+
+	dev->cdev = cdev_alloc();
+	if (dev->cdev == NULL) {
+		mutex_unlock(&boltek_cards_mutex);
+		return -ENOMEM;
+	}
+	dev->cdev->ops = &boltek_file_ops;
+	dev->cdev->owner = THIS_MODULE;
+	rv = cdev_add(dev->cdev, MKDEV(boltek_major, minor), 1);
+	if (rv) {
+		kobject_put(&dev->cdev->kobj);
+		dev->cdev = NULL;
+		mutex_unlock(&boltek_cards_mutex);
+		return rv;
+	}
+
+	dev->minor = minor;
+	dev->active = 1;
+	boltek_cards[minor] = dev;
+	mutex_unlock(&boltek_cards_mutex);
+
+	sysdev = device_create(boltek_class, parent,
+			       MKDEV(boltek_major, minor),
+			       "lightning-%d", minor);
+	if (IS_ERR(sysdev)) {
+		printk(KERN_INFO
+		       "can't create sysfs entry for /dev/lightning-%d\n",
+		       minor);
+	} else {
+		dev_set_drvdata(sysdev, dev);
+		printk(KERN_INFO
+		       "%sBoltek Lightning Detector started at"
+		       " /dev/lightning-%d major %d minor %d\n",
+		       dev->simulated ? "Simulated " : "",
+		       minor, boltek_major, minor);
+	}
+	return 0;
+}
+
+/*
+ * Take the detector away from userspace and stop acquisition. Open
+ * files keep the structure alive, but no longer reach the card.
+ */
+static void boltek_unregister(struct boltek_device *dev)
+{
+	mutex_lock(&boltek_cards_mutex);
+	boltek_cards[dev->minor] = NULL;
+	mutex_unlock(&boltek_cards_mutex);
+
+	device_destroy(boltek_class, MKDEV(boltek_major, dev->minor));
+	cdev_del(dev->cdev);
+
+	boltek_fifo_lock(dev);
+	dev->active = 0;
+	boltek_fifo_unlock(dev);
+	boltek_disarm(dev);
+}
+
 static int __devinit boltek_probe(struct pci_dev *pdev,
 				  const struct pci_device_id *pci_id)
 {
+	struct boltek_device *dev;
 	int rv = 0;
 
-	spin_lock(&boltek_lock);
 	rv = pci_enable_device(pdev);
 	if (rv)	 {
 		dev_err(&pdev->dev, "PCI Enable Failed\n");
-		goto boltek_probe_done;
+		return rv;
 	}
 
 	rv = pci_request_regions(pdev, "boltek");
 	if (rv)	 {
 		dev_err(&pdev->dev, "PCI Request Regions Failed\n");
-		goto boltek_probe_done;
+		goto boltek_probe_disable;
 	}
 
 	/* There is a little problem with another PCI device that is
@@ -274,134 +1305,182 @@ static int __devinit boltek_probe(struct pci_dev *pdev,
 		dev_err(&pdev->dev,
 			"Device BARs unexpected sizes - "
 			"maybe this is not a boltek device?\n");
-		pci_release_regions(pdev);
-		pci_disable_device(pdev);
 		rv = -EFAULT;
-		goto boltek_probe_done;
+		goto boltek_probe_release;
 	}
 
-	detector.ctl = pci_iomap(pdev, 0, 128);
-	detector.mem = pci_iomap(pdev, 2, 16);
-	if ((detector.ctl == NULL) ||
-	    (detector.mem == NULL)) {
+	dev = boltek_alloc();
+	if (dev == NULL) {
+		rv = -ENOMEM;
+		goto boltek_probe_release;
+	}
+	dev->pdev = pdev;
+
+	dev->ctl = pci_iomap(pdev, 0, 128);
+	dev->mem = pci_iomap(pdev, 2, 16);
+	if ((dev->ctl == NULL) ||
+	    (dev->mem == NULL)) {
 		dev_err(&pdev->dev, "Device BAR Mapping problem\n");
-		pci_release_regions(pdev);
-		pci_disable_device(pdev);
 		rv = -EFAULT;
-		goto boltek_probe_done;
+		goto boltek_probe_unmap;
+	}
+	pci_set_drvdata(pdev, dev);
+
+	if (use_irq && pdev->irq) {
+		if (request_irq(pdev->irq, boltek_interrupt, IRQF_SHARED,
+				"boltek", dev))
+			dev_info(&pdev->dev, "irq %d unavailable, polling "
+				 "for strikes instead\n", pdev->irq);
+		else
+			dev->irq = pdev->irq;
 	}
 
-	if (IS_ERR(device_create(detector.class, &pdev->dev,
-				 MKDEV(detector.major, 0),
-				 "lightning-%d", 0)))
-		dev_err(&pdev->dev,
-			"can't create sysfs entry for /dev/lightning-0\n");
-	else
-		printk(KERN_INFO
-		       "Boltek Lightning Detector started at"
-		       " /dev/lightning-0 major %d minor 0\n",
-		       detector.major);
+	rv = boltek_register(dev, &pdev->dev);
+	if (rv) {
+		dev_err(&pdev->dev, "no free minor, at most %d cards\n",
+			BOLTEK_MAX_CARDS);
+		if (dev->irq)
+			free_irq(dev->irq, dev);
+		goto boltek_probe_unmap;
+	}
+	return 0;
 
-	detector.active = 1;
-boltek_probe_done:
-	spin_unlock(&boltek_lock);
+boltek_probe_unmap:
+	if (dev->mem != NULL)
+		pci_iounmap(pdev, dev->mem);
+	if (dev->ctl != NULL)
+		pci_iounmap(pdev, dev->ctl);
+	boltek_put(dev);
+boltek_probe_release:
+	pci_release_regions(pdev);
+boltek_probe_disable:
+	pci_disable_device(pdev);
 	return rv;
 }
 
 static void __devexit boltek_remove(struct pci_dev *pdev)
 {
-	device_destroy(detector.class, MKDEV(detector.major, 0));
+	struct boltek_device *dev = pci_get_drvdata(pdev);
 
-	if (detector.mem != NULL) {
-		pci_iounmap(pdev, detector.mem);
-		detector.mem = NULL;
-	}
+	boltek_unregister(dev);
 
-	if (detector.ctl != NULL) {
-		pci_iounmap(pdev, detector.ctl);
-		detector.ctl = NULL;
+	/* a last close racing with us disarms under fifo_mutex too, and
+	   finds the card gone */
+	boltek_fifo_lock(dev);
+	if (dev->irq) {
+		free_irq(dev->irq, dev);
+		dev->irq = 0;
 	}
 
-	if (detector.active) {
-		detector.active = 0;
-		pci_release_regions(pdev);
-		pci_disable_device(pdev);
-	}
+	pci_iounmap(pdev, dev->mem);
+	dev->mem = NULL;
+	pci_iounmap(pdev, dev->ctl);
+	dev->ctl = NULL;
+	boltek_fifo_unlock(dev);
+
+	pci_release_regions(pdev);
+	pci_disable_device(pdev);
+	pci_set_drvdata(pdev, NULL);
+	dev->pdev = NULL;
+	boltek_put(dev);
 	return;
 }
 
+static void boltek_destroy_simulated(void)
+{
+	struct boltek_device *dev;
+	int minor;
+
+	for (minor = 0; minor < BOLTEK_MAX_CARDS; minor++) {
+		dev = boltek_cards[minor];
+		if (dev == NULL || !dev->simulated)
+			continue;
+		boltek_unregister(dev);
+		boltek_put(dev);
+	}
+}
+
 static int __init boltek_init(void)
 {
+	struct boltek_device *dev;
+	unsigned int i;
+	dev_t devt;
 	int rv;
-	dev_t dev;
-
-	detector.registered = 0;
-	detector.opened = 0;
-	detector.squelch = 0;
-	detector.major	= -1;
-	detector.active = 0;			  /* probe will enable */
-	detector.mem = NULL;
-	detector.ctl = NULL;
-	detector.class = NULL;
-
-	cdev_init(&detector.cdev, &boltek_file_ops);
-	detector.cdev.owner = THIS_MODULE;
 
 	printk(KERN_INFO "Boltek Lightning Detector %s\n", BOLTEK_VERSION);
 
-	detector.class = class_create(THIS_MODULE, "boltek");
-	if (IS_ERR(detector.class)) {
+	if (ring_entries > BOLTEK_RING_MAX_ENTRIES) {
+		printk(KERN_INFO
+		       "boltek ring_entries %u is more than %u\n",
+		       ring_entries, BOLTEK_RING_MAX_ENTRIES);
+		return -EINVAL;
+	}
+
+	boltek_class = class_create(THIS_MODULE, "boltek");
+	if (IS_ERR(boltek_class)) {
 		printk(KERN_INFO
 		       "boltek class creation failed\n");
 		return -EFAULT;
 	}
+	boltek_class->dev_attrs = boltek_dev_attrs;
 
-	rv = alloc_chrdev_region(&dev, 0, 1, "boltek");
-	detector.major = rv ? -1 : MAJOR(dev);
+	rv = alloc_chrdev_region(&devt, 0, BOLTEK_MAX_CARDS, "boltek");
+	boltek_major = rv ? -1 : MAJOR(devt);
 
-	if (detector.major < 0) {
+	if (boltek_major < 0) {
 		printk(KERN_INFO
 		       "boltek alloc chrdev failed\n");
+		class_destroy(boltek_class);
 		return -EFAULT;
 	}
 
-	cdev_add(&detector.cdev, MKDEV(detector.major, 0), 1);
+	if (simulate) {
+		for (i = 0; i < simulate && i < BOLTEK_MAX_CARDS; i++) {
+			dev = boltek_alloc();
+			if (dev == NULL)
+				break;
+			dev->simulated = 1;
+			if (boltek_register(dev, NULL)) {
+				boltek_put(dev);
+				break;
+			}
+		}
+		return 0;
+	}
 
 	rv = pci_register_driver(&boltek_pci_driver);
 	if (rv) {
 		printk(KERN_INFO
 		       "boltek register failed\n");
+		unregister_chrdev_region(MKDEV(boltek_major, 0),
+					 BOLTEK_MAX_CARDS);
+		class_destroy(boltek_class);
 		return rv;
 	}
 
-	detector.registered = 1;
+	boltek_registered = 1;
 	return 0;
 }
 
 static void __exit boltek_exit(void)
 {
+	int minor;
+
 	printk(KERN_INFO
 	       "Boltek Lightning Detector Module Removal %s\n", BOLTEK_VERSION);
 
-	if (detector.registered)
+	if (boltek_registered)
 		pci_unregister_driver(&boltek_pci_driver);
+	boltek_registered = 0;
 
-	if (detector.major >= 0) {
-		cdev_del(&detector.cdev);
-		unregister_chrdev_region(MKDEV(detector.major, 0), 1);
-	}
-
-	if (detector.class)
-		class_destroy(detector.class);
-
-	detector.registered = 0;
-	detector.major = -1;
+	boltek_destroy_simulated();
 
-	WARN_ON(detector.opened);
-	WARN_ON(detector.active);
-	WARN_ON(detector.mem != NULL);
-	WARN_ON(detector.ctl != NULL);
+	for (minor = 0; minor < BOLTEK_MAX_CARDS; minor++)
+		WARN_ON(boltek_cards[minor] != NULL);
 
+	unregister_chrdev_region(MKDEV(boltek_major, 0), BOLTEK_MAX_CARDS);
+	boltek_major = -1;
+	class_destroy(boltek_class);
 	return;
 }
 
@@ -0,0 +1,82 @@
+/*
+ *  Tracepoints for the Boltek StormTracker PCI Lightning Detector
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Every event follows one capture through the driver: the trigger,
+ *  the FIFO drain, the board re-arm and the copy to a reader. seq is
+ *  the number the capture has (or will have once drained), so the
+ *  events of one strike line up in ftrace or perf.
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM boltek
+
+#if !defined(_BOLTEK_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _BOLTEK_TRACE_H
+
+#include <linux/tracepoint.h>
+
+DECLARE_EVENT_CLASS(boltek_capture,
+
+	TP_PROTO(int minor, u64 seq, u16 squelch),
+
+	TP_ARGS(minor, seq, squelch),
+
+	TP_STRUCT__entry(
+		__field(int, minor)
+		__field(u64, seq)
+		__field(u16, squelch)
+	),
+
+	TP_fast_assign(
+		__entry->minor = minor;
+		__entry->seq = seq;
+		__entry->squelch = squelch;
+	),
+
+	TP_printk("lightning-%d seq=%llu squelch=%u", __entry->minor,
+		  (unsigned long long)__entry->seq, __entry->squelch)
+);
+
+/* the board reported a strike, from the interrupt, poll timer or simulator */
+DEFINE_EVENT(boltek_capture, boltek_trigger,
+	TP_PROTO(int minor, u64 seq, u16 squelch),
+	TP_ARGS(minor, seq, squelch)
+);
+
+DEFINE_EVENT(boltek_capture, boltek_drain_start,
+	TP_PROTO(int minor, u64 seq, u16 squelch),
+	TP_ARGS(minor, seq, squelch)
+);
+
+/* the capture is in the ring and readers can see it */
+DEFINE_EVENT(boltek_capture, boltek_drain_end,
+	TP_PROTO(int minor, u64 seq, u16 squelch),
+	TP_ARGS(minor, seq, squelch)
+);
+
+/* the board is waiting for the strike after seq */
+DEFINE_EVENT(boltek_capture, boltek_rearm,
+	TP_PROTO(int minor, u64 seq, u16 squelch),
+	TP_ARGS(minor, seq, squelch)
+);
+
+/* a reader got the capture through read() or GET_DATA */
+DEFINE_EVENT(boltek_capture, boltek_copy_to_user,
+	TP_PROTO(int minor, u64 seq, u16 squelch),
+	TP_ARGS(minor, seq, squelch)
+);
+
+#endif /* _BOLTEK_TRACE_H */
+
+/* this header is not in include/trace/events */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE boltek_trace
+
+#include <trace/define_trace.h>
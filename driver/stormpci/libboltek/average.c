@@ -0,0 +1,206 @@
+/* Bearing averaging for the Boltek Lightning Detector SDK
+   The circle is divided into average_bins bearings, each with an average
+   strike distance that every strike at that bearing may only pull a
+   little (see Capture_ConvertToStrike). A strike also pulls the
+   average_spread bearings either side of its own, wrapping through
+   north. Averages age by the time of the captures, not of the machine
+   processing them, so a replay gives the same strikes at any speed.
+   STORMPROCESS_MATH_FIXED keeps averages of its own, in fixed point.
+*/
+
+#include <time.h>
+
+#include "stormpci.h"
+#include "stormpci_int.h"
+
+
+// the time averages age by, in milliseconds: the capture's GPS time
+// when it has one, otherwise the wall clock
+long long
+Average_Clock(const StormProcess_tTIMESTAMPINFO *ts)
+{
+        struct timespec now;
+        long long ms;
+
+        if (Timestamp_Millis(ts, &ms)) return ms;
+        clock_gettime (CLOCK_REALTIME, &now);
+        return now.tv_sec * 1000LL + now.tv_nsec / 1000000;
+}
+
+// an average older than average_duration, or set by a capture later than
+// now (a replay started over, or a bad GPS time)
+static inline int
+Average_Expired(const StormProcess_tPARAMS *params, long long now, long long when)
+{
+        return now - when > params->average_duration * 1000LL || now < when;
+}
+
+// a neighbour's average that is young enough to be smoothed
+static inline int
+Average_Current(const StormProcess_tPARAMS *params, long long now, long long when)
+{
+        return now - when < params->average_duration * 1000LL && now >= when;
+}
+
+// the bearings a strike at bearing also pulls: -1, +1, -2, +2 ...
+// wrapping through north
+static inline void
+Average_Neighbours(const StormProcess_tPARAMS *params, int bearing, int *neighbour)
+{
+        int bins = params->average_bins;
+        int n;
+
+        for (n = 0; n < 2 * params->average_spread; n++)
+        {
+                int offset = n & 1 ? n / 2 + 1 : -(n / 2 + 1);
+
+                neighbour[n] = (bearing + offset + bins) % bins;
+        }
+        return;
+}
+
+// LIMIT FAR STRIKES AND AVERAGE CLOSE STRIKES
+static inline double
+Average_Limit(const StormProcess_tPARAMS *params, double Delta, double MaxDelta)
+{
+        if (Delta > MaxDelta)
+                return MaxDelta;
+        return (float)(Delta * params->delta_minus_filter);
+}
+
+// the same in fixed point
+static inline __s32
+Average_LimitFixed(const struct fixed_params *fixed, __s32 Delta)
+{
+        if (Delta > fixed->max_delta)
+                return fixed->max_delta;
+        return (__s32) ((Delta * fixed->delta_minus_filter) >> FIX_RATIO_BITS);
+}
+
+// Capture_Average for STORMPROCESS_MATH_FIXED, the same steps on
+// AverageFixed. Only the strike itself is converted to floating point
+static StormProcess_tSTRIKE
+Average_Fixed(StormProcess_Context *ctx, const struct strike_geometry *geom)
+{
+        const StormProcess_tPARAMS *params = &ctx->params;
+        const struct fixed_params *fixed = &ctx->fixed;
+        __s32 *Average = ctx->AverageFixed;
+        long long *AverageTime = ctx->AverageTime;
+        __s32 New_Distance = geom->fixed_distance, d_bearing = geom->fixed_bearing;
+        long long now = geom->time;
+        __s32 Delta, NeighbourDelta[2 * AVERAGE_MAX_SPREAD];
+        int bins = params->average_bins, spread = params->average_spread;
+        int bearing, neighbour[2 * AVERAGE_MAX_SPREAD];
+        int n;
+        StormProcess_tSTRIKE new_strike;
+
+        bearing = (int)(((__s64) d_bearing * bins) / FIX_ANGLE(360));
+        if (bearing < 0) bearing = 0;
+        if (bearing >= bins) bearing = bins - 1;
+        Average_Neighbours(params, bearing, neighbour);
+
+        if (Average_Expired(params, now, AverageTime[bearing])) {
+                Average[bearing] = New_Distance;
+                AverageTime[bearing] = now;
+        }
+        else {
+                Delta = New_Distance - Average[bearing];
+                for (n = 0; n < 2 * spread; n++)
+                        NeighbourDelta[n] = New_Distance - Average[neighbour[n]];
+
+                Average[bearing] = Average[bearing] + Average_LimitFixed(fixed, Delta);
+                AverageTime[bearing] = now;
+
+                for (n = 0; n < 2 * spread; n++)
+                {
+                        int adjacentbearing = neighbour[n];
+
+                        if (Average_Current(params, now, AverageTime[adjacentbearing]))
+                                Average[adjacentbearing] = Average[adjacentbearing] +
+                                        Average_LimitFixed(fixed, NeighbourDelta[n]) / 2;
+                        else
+                                Average[adjacentbearing] = Average[bearing];
+                        AverageTime[adjacentbearing] = now;
+                }
+        }
+
+        new_strike.valid = 0;
+        new_strike.distance = (float) New_Distance * (1.0f / (1 << FIX_DISTANCE_BITS));
+        new_strike.distance_averaged = (float) (Average[bearing] * fixed->miles) *
+                (1.0f / (1LL << (FIX_DISTANCE_BITS + FIX_MILES_BITS)));
+        new_strike.direction = (float) d_bearing * (1.0f / (1 << FIX_ANGLE_BITS));
+        return new_strike;
+}
+
+StormProcess_tSTRIKE
+Capture_Average(StormProcess_Context *ctx, const struct strike_geometry *geom)
+/*
+  Second half of Capture_ConvertToStrike: factors the strike into the
+  bearing averages. Strikes must be passed in capture order.
+*/
+{
+        const StormProcess_tPARAMS *params = &ctx->params;
+        double *Average = ctx->Average;
+        long long *AverageTime = ctx->AverageTime;
+        double New_Distance = geom->New_Distance, d_bearing = geom->d_bearing;
+        long long now = geom->time;
+        double Delta, MaxDelta, NeighbourDelta[2 * AVERAGE_MAX_SPREAD];
+        int bins = params->average_bins, spread = params->average_spread;
+        int bearing, neighbour[2 * AVERAGE_MAX_SPREAD];
+        int n;
+        StormProcess_tSTRIKE new_strike;
+
+        if (ctx->math == STORMPROCESS_MATH_FIXED)
+                return Average_Fixed(ctx, geom);
+
+        bearing = (int)(d_bearing / (360.0 / bins));
+        if (bearing < 0) bearing = 0;
+        if (bearing >= bins) bearing = bins - 1;
+        Average_Neighbours(params, bearing, neighbour);
+
+        /*  Check if average = zero. Set average to this strike. An average
+            from after this capture is as stale as an old one  */
+        if (Average_Expired(params, now, AverageTime[bearing])) {
+                /*  AVERAGE HASN'T BEEN SET YET  */
+                Average[bearing] = New_Distance;
+                AverageTime[bearing] = now;   /*  timestamp the average  */
+        }
+        else {
+                /*  FACTOR IN NEW STRIKE  */
+                /*  Calc how much this strike changes our current average  */
+                Delta = New_Distance - Average[bearing];
+                for (n = 0; n < 2 * spread; n++)
+                        NeighbourDelta[n] = New_Distance - Average[neighbour[n]];
+
+                /*  Limit how much one strike can pull us away from center  */
+                /*  Limit based on strike rate  */
+                MaxDelta = (float)(params->r_screen_limit / (params->delta_plus_limit_m *
+                                                             /*strike/min + */  params->delta_plus_limit_b));
+
+                /*  Now Adjust average distance for this new strike  */
+                // 8/24/98 - Elapsed() > AVERAGEDURATION changed to < AVERAGEDURATION
+                Average[bearing] = Average[bearing] + Average_Limit(params, Delta, MaxDelta);
+                AverageTime[bearing] = now;   /*  timestamp the average  */
+
+                for (n = 0; n < 2 * spread; n++)  // smooth distances with adjacent bearings
+                {
+                        int adjacentbearing = neighbour[n];
+
+                        if (Average_Current(params, now, AverageTime[adjacentbearing]))
+                                Average[adjacentbearing] = Average[adjacentbearing] +
+                                        Average_Limit(params, NeighbourDelta[n], MaxDelta) / 2;
+                        else
+                                Average[adjacentbearing] = Average[bearing];   /*  set adjacent to current  */
+                        AverageTime[adjacentbearing] = now;   /*  timestamp the average  */
+                }
+        } /* END FACTOR IN NEW STRIKE */
+
+        /*  The strike is reported as its bearing and averaged distance, the
+            X and Y it would be plotted at are left to the application  */
+
+        new_strike.valid = 0;
+        new_strike.distance = (float)New_Distance; // unaveraged
+        new_strike.distance_averaged = (float)(Average[bearing] / (params->r_screen_limit / params->miles_scale)); // store distance in miles;
+        new_strike.direction = (float)d_bearing;
+        return new_strike;
+}
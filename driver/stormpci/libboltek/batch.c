@@ -0,0 +1,217 @@
+/* Batch processing for the Boltek Lightning Detector SDK
+   Runs the per-capture stages of StormProcess_SSProcessCapture for many
+   captures across a pool of worker threads. Only the bearing averaging
+   depends on capture order, it runs afterwards on the calling thread so
+   the results are the same as processing the captures one at a time.
+*/
+
+#include <pthread.h>
+#include <unistd.h>
+#include <stdlib.h>
+
+#include "stormpci.h"
+#include "stormpci_int.h"
+
+#define BATCH_BLOCK 1024    /*  captures per parallel round  */
+#define BATCH_CHUNK 16      /*  captures a thread claims at a time  */
+
+struct batch_item
+{
+        struct strike_geometry geom;
+        int reject;             // REJECT_, geom is only set for strikes
+};
+
+struct batch_pool
+{
+        pthread_mutex_t lock;
+        pthread_cond_t work;            // a new round was posted
+        pthread_cond_t done;            // the last worker finished a round
+        pthread_t *threads;
+        int nthreads;                   // workers, the caller thread helps too
+        int busy;                       // workers still in the current round
+        unsigned long round;
+        int shutdown;
+
+        // the current round
+        const StormProcess_Context *ctx;
+        const StormProcess_tPACKEDDATA *packed;
+        size_t count;
+        size_t next;                    // first unclaimed capture, atomic
+
+        struct batch_item items[BATCH_BLOCK];
+};
+
+
+static void
+Batch_ProcessRange(struct batch_pool *pool)
+{
+        size_t i, end;
+
+        for (;;)
+        {
+                i = __atomic_fetch_add (&pool->next, BATCH_CHUNK, __ATOMIC_RELAXED);
+                if (i >= pool->count) break;
+                end = i + BATCH_CHUNK < pool->count ? i + BATCH_CHUNK : pool->count;
+
+                for (; i < end; i++)
+                        pool->items[i].reject = Capture_Packed(pool->ctx, &pool->packed[i],
+                                                               &pool->items[i].geom);
+        }
+        return;
+}
+
+static void *
+Batch_Worker(void *arg)
+{
+        struct batch_pool *pool = arg;
+        unsigned long seen = 0;
+
+        pthread_mutex_lock (&pool->lock);
+        for (;;)
+        {
+                while (!pool->shutdown && pool->round == seen)
+                        pthread_cond_wait (&pool->work, &pool->lock);
+                if (pool->shutdown) break;
+                seen = pool->round;
+                pthread_mutex_unlock (&pool->lock);
+
+                Batch_ProcessRange(pool);
+
+                pthread_mutex_lock (&pool->lock);
+                if (--pool->busy == 0)
+                        pthread_cond_signal (&pool->done);
+        }
+        pthread_mutex_unlock (&pool->lock);
+        return NULL;
+}
+
+static void
+Batch_Round(struct batch_pool *pool, const StormProcess_tPACKEDDATA *packed, size_t count)
+{
+        pthread_mutex_lock (&pool->lock);
+        pool->packed = packed;
+        pool->count = count;
+        pool->next = 0;
+        pool->busy = pool->nthreads;
+        pool->round++;
+        pthread_cond_broadcast (&pool->work);
+        pthread_mutex_unlock (&pool->lock);
+
+        Batch_ProcessRange(pool);
+
+        pthread_mutex_lock (&pool->lock);
+        while (pool->busy)
+                pthread_cond_wait (&pool->done, &pool->lock);
+        pthread_mutex_unlock (&pool->lock);
+        return;
+}
+
+static struct batch_pool *
+Batch_Create(StormProcess_Context *ctx)
+{
+        struct batch_pool *pool;
+        long cpus;
+        int nthreads, i;
+
+        nthreads = ctx->threads;
+        if (nthreads <= 0)
+        {
+                cpus = sysconf (_SC_NPROCESSORS_ONLN);
+                nthreads = cpus > 0 ? (int) cpus : 1;
+        }
+        nthreads--;     /* the caller is the first thread */
+
+        pool = calloc (1, sizeof(*pool));
+        if (pool == NULL) return NULL;
+        pool->ctx = ctx;
+        pool->threads = calloc (nthreads + 1, sizeof(*pool->threads));
+        if (pool->threads == NULL)
+        {
+                free (pool);
+                return NULL;
+        }
+        pthread_mutex_init (&pool->lock, NULL);
+        pthread_cond_init (&pool->work, NULL);
+        pthread_cond_init (&pool->done, NULL);
+
+        for (i = 0; i < nthreads; i++)
+        {
+                if (pthread_create (&pool->threads[i], NULL, Batch_Worker, pool))
+                        break;
+        }
+        pool->nthreads = i;
+        return pool;
+}
+
+void
+Batch_Destroy(StormProcess_Context *ctx)
+{
+        struct batch_pool *pool = ctx->pool;
+        int i;
+
+        if (pool == NULL) return;
+
+        pthread_mutex_lock (&pool->lock);
+        pool->shutdown = 1;
+        pthread_cond_broadcast (&pool->work);
+        pthread_mutex_unlock (&pool->lock);
+        for (i = 0; i < pool->nthreads; i++)
+                pthread_join (pool->threads[i], NULL);
+
+        pthread_cond_destroy (&pool->done);
+        pthread_cond_destroy (&pool->work);
+        pthread_mutex_destroy (&pool->lock);
+        free (pool->threads);
+        free (pool);
+        ctx->pool = NULL;
+        return;
+}
+
+
+// 0 for one thread per online cpu, 1 to process on the calling thread only
+// - non-zero on success
+int
+StormProcess_SetThreads(StormProcess_Context *ctx, int threads)
+{
+        if (threads < 0) return 0;
+
+        Batch_Destroy(ctx);
+        ctx->threads = threads;
+        return 1;
+}
+
+//==================================================================
+// Process n captures in order. strikes_out[i] is the same as unpacking
+// packed[i] and passing it to StormProcess_SSProcessCaptureCtx, in turn
+// for every i. Non-zero on success.
+//
+int
+StormProcess_ProcessBatch(StormProcess_Context *ctx, const StormProcess_tPACKEDDATA packed[],
+                          size_t n, StormProcess_tSTRIKE strikes_out[])
+{
+        struct batch_pool *pool;
+        size_t base, count, i;
+
+        if (ctx->pool == NULL)
+                ctx->pool = Batch_Create(ctx);
+        pool = ctx->pool;
+        if (pool == NULL) return 0;
+
+        for (base = 0; base < n; base += count)
+        {
+                count = n - base < BATCH_BLOCK ? n - base : BATCH_BLOCK;
+                Batch_Round(pool, &packed[base], count);
+
+                for (i = 0; i < count; i++)
+                {
+                        if (Capture_Count(ctx, pool->items[i].reject))
+                        {
+                                strikes_out[base + i] = Capture_Rejected();
+                                continue;
+                        }
+                        strikes_out[base + i] = Capture_Average(ctx, &pool->items[i].geom);
+                        strikes_out[base + i].valid = 1;
+                }
+        }
+        return 1;
+}
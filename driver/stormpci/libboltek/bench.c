@@ -0,0 +1,795 @@
+/* Micro-benchmarks for the Boltek SDK processing kernels
+   Times each kernel with the portable C code and with the best vector
+   code the cpu supports, after checking the two agree. Then times each
+   stage of the processing chain, and the whole chain, over a corpus of
+   captures: per capture, captures a second and cpu cycles per capture.
+   Before timing anything it checks the math modes against the exact
+   math, and that batch, packed and compact processing give the same
+   strikes as unpacking and StormProcess_SSProcessCaptureCtx().
+
+   ./bench [-j] [-f capturefile] [-n captures] [iterations]
+
+   -j   one JSON object a line for every result, on stdout; the tables
+        and the checks go to stderr
+   -f   time the stages over a recorded capture file as well
+   -n   synthetic captures in the corpus, 1000 by default
+
+   Cycles are counted by the kernel's cpu-cycles event where it can be
+   opened, otherwise by the time stamp counter on x86; -1 without either.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "stormpci.h"
+#include "stormpci_int.h"
+
+static StormProcess_tPACKEDDATA packed;
+static StormProcess_tPACKEDDATA noise;             // rejected, no E-field
+static StormProcess_tPACKEDDATA gps_packed[2];     // two GPS records
+static StormProcess_tBOARDDATA board;
+static StormProcess_Context *ctx;
+static int json;                // -j
+static FILE *table;             // the human readable output
+
+static double
+Now(void)
+{
+        struct timespec ts;
+
+        clock_gettime (CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// a decaying oscillation from the north-east, clipped at its first peak
+static void
+MakeCapture(void)
+{
+        int cnt, n, e;
+        double wave;
+
+        for (cnt = 0; cnt < BOLTEK_BUFFERSIZE; cnt++)
+        {
+                wave = sin (cnt * 0.05) * exp (-cnt / 150.0);
+                n = 128 + (int) (160 * wave);
+                e = 128 + (int) (90 * wave);
+                n = n < 0 ? 0 : n > 255 ? 255 : n;
+                e = e < 0 ? 0 : e > 255 ? 255 : e;
+                packed.usNorth[cnt] = n | (wave > 0 ? 0x100 : 0);
+                packed.usWest[cnt] = e;
+        }
+        StormProcess_UnpackCaptureData(&packed, &board);
+        Capture_Filter(&board);
+
+        for (cnt = 0; cnt < BOLTEK_BUFFERSIZE; cnt++)
+        {
+                gps_packed[0].usWest[cnt] = packed.usWest[cnt] | ((cnt * 37) & 0xff) << 8;
+                gps_packed[1].usWest[cnt] = packed.usWest[cnt] | ((cnt * 41) & 0xff) << 8;
+                noise.usNorth[cnt] = (cnt * cnt * 73 + 11) % 251;
+                noise.usWest[cnt] = (cnt * cnt * 59 + 37) % 241;
+        }
+        return;
+}
+
+static void
+Bench_Unpack(void)
+{
+        Unpack_Samples(&packed, &board);
+        return;
+}
+
+static void
+Bench_Find_Peaks(void)
+{
+        Capture_Find_Peaks(&board);
+        return;
+}
+
+// a different GPS record every time, so it is always decoded
+static void
+Bench_GPS(void)
+{
+        static int record;
+
+        ExtractGPSData(&gps_packed[record ^= 1]);
+        return;
+}
+
+// the staged path, unpack and StormProcess_SSProcessCaptureCtx
+static void
+Bench_Process(void)
+{
+        StormProcess_UnpackCaptureData(&packed, &board);
+        StormProcess_SSProcessCaptureCtx(ctx, &board);
+        return;
+}
+
+static void
+Bench_Process_Packed(void)
+{
+        StormProcess_ProcessPacked(ctx, &packed);
+        return;
+}
+
+// a trigger on noise, turned away before the strike is worked out
+static void
+Bench_Process_Noise(void)
+{
+        StormProcess_ProcessPacked(ctx, &noise);
+        return;
+}
+
+// a strike from a different pair of peaks every time
+static void
+Bench_Geometry(void)
+{
+        static int n;
+        struct strike_geometry geom;
+
+        n = (n + 97) & 2047;
+        Geometry_Strike(ctx, n, 2047 - n, 1, -1, &geom);
+        __asm__ volatile ("" : : "r" (&geom) : "memory");
+        return;
+}
+
+struct benchmark
+{
+        const char *name;
+        void (*run)(void);
+};
+
+// C against the best vector kernels
+static const struct benchmark benchmarks[] =
+{
+        { "unpack", Bench_Unpack },
+        { "find_peaks", Bench_Find_Peaks },
+        { "gps_decode", Bench_GPS },
+        { "process", Bench_Process },
+        { "process_packed", Bench_Process_Packed },
+        { "process_noise", Bench_Process_Noise },
+};
+
+// STORMPROCESS_MATH_EXACT against the other modes
+static const struct benchmark math_benchmarks[] =
+{
+        { "geometry", Bench_Geometry },
+        { "process_packed", Bench_Process_Packed },
+};
+
+// the error bounds of a math mode against STORMPROCESS_MATH_EXACT, with
+// default params. Those of the geometry are documented in its source
+struct math_mode
+{
+        int math;
+        const char *name;
+        double bearing;         // degrees
+        double distance;        // relative, before suck-in
+        double miles;           // strikes within miles_scale
+        double averaged;        // miles, distance_averaged of a capture stream
+};
+
+static const struct math_mode math_modes[] =
+{
+        { STORMPROCESS_MATH_FAST, "fast", 0.0005, 0.00002, 0.005, 0.05 },
+        { STORMPROCESS_MATH_FIXED, "fixed", 0.0001, 0.000001, 0.0005, 0.01 },
+};
+
+#define CORPUS_CAPTURES 200000
+
+// bearing and New_Distance of a geometry in any mode
+static void
+Geometry_Result(int math, const struct strike_geometry *geom, double *bearing, double *distance)
+{
+        if (math == STORMPROCESS_MATH_FIXED)
+        {
+                *bearing = geom->fixed_bearing / (double) (1 << FIX_ANGLE_BITS);
+                *distance = geom->fixed_distance / (double) (1 << FIX_DISTANCE_BITS);
+                return;
+        }
+        *bearing = geom->d_bearing;
+        *distance = geom->New_Distance;
+        return;
+}
+
+// the mode against the reference for every pair of peaks up to 2047 and
+// all four polarities - non-zero within the bounds
+static int
+Check_Geometry(const struct math_mode *mode)
+{
+        StormProcess_Context *mctx = StormProcess_CreateContext(NULL);
+        StormProcess_tPARAMS params;
+        struct strike_geometry exact, other;
+        double suck, stretch, miles, bearing = 0, distance = 0, far = 0, a, b;
+        double other_bearing, other_distance;
+        int north, east, pol;
+
+        StormProcess_SetMath(mctx, mode->math);
+        StormProcess_DefaultParams(&params);
+        suck = params.r_screen_limit * params.suckin;
+        stretch = params.r_screen_limit / (params.r_screen_limit - suck);
+        miles = params.miles_scale / params.r_screen_limit;
+        for (pol = 0; pol < 4; pol++)
+        for (north = 0; north < 2048; north++)
+        for (east = 0; east < 2048; east++)
+        {
+                Geometry_FromPeaks(&params, north, east, pol & 1 ? 1 : -1, pol & 2 ? 1 : -1, &exact);
+                Geometry_Strike(mctx, north, east, pol & 1 ? 1 : -1, pol & 2 ? 1 : -1, &other);
+                Geometry_Result(mode->math, &other, &other_bearing, &other_distance);
+                bearing = fmax (bearing, fabs (exact.d_bearing - other_bearing));
+                if (exact.New_Distance <= params.r_screen_limit)
+                        far = fmax (far, fabs (exact.New_Distance - other_distance) * miles);
+                if (exact.New_Distance > 0 && other_distance > 0)
+                {
+                        /*  undo the suck-in, which has no error of its own  */
+                        a = exact.New_Distance / stretch + suck;
+                        b = other_distance / stretch + suck;
+                        distance = fmax (distance, fabs (a - b) / a);
+                }
+        }
+        StormProcess_DestroyContext(mctx);
+        fprintf (table, "%s geometry: bearing within %.2g degrees, distance within %.2g (%.2g miles)\n",
+                mode->name, bearing, distance, far);
+        return bearing <= mode->bearing && distance <= mode->distance && far <= mode->miles;
+}
+
+static double
+Random(__u64 *seed)
+{
+        *seed = *seed * 6364136223846793005ULL + 1442695040888963407ULL;
+        return (*seed >> 11) * (1.0 / 9007199254740992.0);
+}
+
+// a decaying oscillation of random strength, bearing, ring and polarity
+static void
+MakeStrike(StormProcess_tPACKEDDATA *capture, __u64 *seed)
+{
+        double amplitude = 10 + Random(seed) * 150, bearing = Random(seed) * 2 * M_PI;
+        double period = 0.03 + Random(seed) * 0.05, decay = 80 + Random(seed) * 150;
+        int flip = Random(seed) < 0.5;
+        int cnt, n, e;
+        double wave;
+
+        for (cnt = 0; cnt < BOLTEK_BUFFERSIZE; cnt++)
+        {
+                wave = cnt < 20 ? 0 : sin ((cnt - 20) * period) * exp (-(cnt - 20) / decay);
+                n = 128 + (int) (amplitude * cos (bearing) * wave);
+                e = 128 + (int) (amplitude * sin (bearing) * wave);
+                n = n < 0 ? 0 : n > 255 ? 255 : n;
+                e = e < 0 ? 0 : e > 255 ? 255 : e;
+                capture->usNorth[cnt] = n | ((wave > 0) != flip ? 0x100 : 0);
+                capture->usWest[cnt] = e;
+        }
+        return;
+}
+
+// the mode against the reference over a stream of captures, averages
+// and all - non-zero within the bounds
+static int
+Check_Captures(const struct math_mode *mode)
+{
+        StormProcess_Context *exact_ctx = StormProcess_CreateContext(NULL);
+        StormProcess_Context *mctx = StormProcess_CreateContext(NULL);
+        StormProcess_tPARAMS params;
+        StormProcess_tPACKEDDATA capture;
+        StormProcess_tSTRIKE exact, other;
+        double direction = 0, distance = 0, averaged = 0;
+        __u64 seed = 1;
+        int cnt, same = 1;
+
+        StormProcess_SetMath(mctx, mode->math);
+        StormProcess_DefaultParams(&params);
+        for (cnt = 0; cnt < CORPUS_CAPTURES; cnt++)
+        {
+                MakeStrike(&capture, &seed);
+                exact = StormProcess_ProcessPacked(exact_ctx, &capture);
+                other = StormProcess_ProcessPacked(mctx, &capture);
+                same &= exact.valid == other.valid;
+                direction = fmax (direction, fabs (exact.direction - other.direction));
+                if (exact.distance <= params.r_screen_limit)
+                        distance = fmax (distance, fabs (exact.distance - other.distance) *
+                                         params.miles_scale / params.r_screen_limit);
+                averaged = fmax (averaged, fabs (exact.distance_averaged - other.distance_averaged));
+        }
+        StormProcess_DestroyContext(exact_ctx);
+        StormProcess_DestroyContext(mctx);
+        fprintf (table, "%s captures: direction within %.2g degrees, distance within %.2g miles, "
+                "averaged within %.2g miles\n", mode->name, direction, distance, averaged);
+        return same && direction <= mode->bearing && distance <= mode->miles && averaged <= mode->averaged;
+}
+
+#define PATH_CAPTURES 50000
+#define PATH_BATCH 1000
+
+// ProcessBatch, ProcessPacked and SSProcessCapture2Ctx against unpacking
+// and SSProcessCaptureCtx, in one math mode, over a synthetic storm with
+// noise, clipping and GPS time - non-zero if every strike is the same
+static int
+Check_Paths(int math, const char *name)
+{
+        StormProcess_Context *ref_ctx = StormProcess_CreateContext(NULL);
+        StormProcess_Context *packed_ctx = StormProcess_CreateContext(NULL);
+        StormProcess_Context *compact_ctx = StormProcess_CreateContext(NULL);
+        StormProcess_Context *batch_ctx = StormProcess_CreateContext(NULL);
+        StormProcess_tPACKEDDATA *captures = calloc (PATH_BATCH, sizeof(*captures));
+        StormProcess_tSTRIKE *batched = calloc (PATH_BATCH, sizeof(*batched));
+        StormProcess_tSYNTHPARAMS params;
+        StormProcess_Synth *synth;
+        StormProcess_tBOARDDATA unpacked;
+        StormProcess_tBOARDDATA2 compact;
+        StormProcess_tSTRIKE ref, other;
+        unsigned long batch = 0, packed_diff = 0, compact_diff = 0;
+        int cnt, i, ok;
+
+        StormProcess_DefaultSynthParams(&params);
+        params.rate = 1000;
+        params.min_miles = 0;
+        params.max_miles = 300;
+        params.start_ns = 1700000000000000000LL;
+        synth = StormProcess_CreateSynth(NULL, &params);
+        ok = ref_ctx && packed_ctx && compact_ctx && batch_ctx && captures && batched && synth &&
+             StormProcess_SetThreads(batch_ctx, 4);
+        StormProcess_SetMath(ref_ctx, math);
+        StormProcess_SetMath(packed_ctx, math);
+        StormProcess_SetMath(compact_ctx, math);
+        StormProcess_SetMath(batch_ctx, math);
+        for (cnt = 0; ok && cnt < PATH_CAPTURES; cnt += PATH_BATCH)
+        {
+                for (i = 0; i < PATH_BATCH; i++)
+                        StormProcess_SynthCapture(synth, &captures[i], NULL);
+                ok = StormProcess_ProcessBatch(batch_ctx, captures, PATH_BATCH, batched);
+                for (i = 0; ok && i < PATH_BATCH; i++)
+                {
+                        StormProcess_UnpackCaptureData(&captures[i], &unpacked);
+                        ref = StormProcess_SSProcessCaptureCtx(ref_ctx, &unpacked);
+                        batch += memcmp (&ref, &batched[i], sizeof(ref)) != 0;
+                        other = StormProcess_ProcessPacked(packed_ctx, &captures[i]);
+                        packed_diff += memcmp (&ref, &other, sizeof(ref)) != 0;
+                        StormProcess_UnpackCaptureData2(&captures[i], &compact);
+                        other = StormProcess_SSProcessCapture2Ctx(compact_ctx, &compact);
+                        compact_diff += memcmp (&ref, &other, sizeof(ref)) != 0;
+                }
+        }
+        StormProcess_DestroySynth(synth);
+        free (batched);
+        free (captures);
+        StormProcess_DestroyContext(batch_ctx);
+        StormProcess_DestroyContext(compact_ctx);
+        StormProcess_DestroyContext(packed_ctx);
+        StormProcess_DestroyContext(ref_ctx);
+        if (!ok)
+        {
+                fprintf (table, "%s paths: out of memory\n", name);
+                return 0;
+        }
+        fprintf (table, "%s paths: of %d strikes, %lu batched, %lu packed and %lu compact "
+                "differ from unpacked\n", name, PATH_CAPTURES, batch, packed_diff, compact_diff);
+        return batch == 0 && packed_diff == 0 && compact_diff == 0;
+}
+
+// ns per call
+static double
+Time(void (*run)(void), long iterations)
+{
+        double start;
+        long i;
+
+        run ();         /* warm up */
+        start = Now ();
+        for (i = 0; i < iterations; i++)
+        {
+                run ();
+                __asm__ volatile ("" : : "r" (&board) : "memory");
+        }
+        return (Now () - start) * 1e9 / iterations;
+}
+
+
+//==================================================================
+// The stage suite. Every stage is timed a pass over the corpus at a
+// time, each capture starting as the stage before leaves it; the
+// captures are put back between passes, outside the timing.
+//
+static int cycles_fd = -1;
+static const char *cycles_source = "none";
+
+static void
+Cycles_Open(void)
+{
+        struct perf_event_attr attr;
+
+        memset (&attr, 0, sizeof(attr));
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.size = sizeof(attr);
+        attr.config = PERF_COUNT_HW_CPU_CYCLES;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        cycles_fd = syscall (__NR_perf_event_open, &attr, 0, -1, -1, 0);
+        if (cycles_fd >= 0)
+                cycles_source = "perf";
+#if defined(__x86_64__) || defined(__i386__)
+        else
+                cycles_source = "tsc";
+#endif
+        return;
+}
+
+static unsigned long long
+Cycles(void)
+{
+        unsigned long long count;
+
+        if (cycles_fd >= 0 && read (cycles_fd, &count, sizeof(count)) == sizeof(count))
+                return count;
+#if defined(__x86_64__) || defined(__i386__)
+        return __builtin_ia32_rdtsc ();
+#else
+        return 0;
+#endif
+}
+
+// the boards of a corpus, as each stage leaves them
+#define BOARD_UNPACKED 0        // StormProcess_UnpackCaptureData
+#define BOARD_FILTERED 1        // Capture_Filter
+#define BOARD_PEAKS 2           // Capture_Find_Peaks
+#define BOARD_CHECKED 3         // Capture_Valid
+#define BOARDS 4
+
+struct corpus
+{
+        const char *name;
+        StormProcess_tPACKEDDATA *packed;
+        size_t count;
+        size_t valid;                           // captures Capture_Valid passes
+        int *reject;                            // Capture_Valid of each capture
+        StormProcess_tBOARDDATA *boards[BOARDS];
+        StormProcess_tBOARDDATA *work;          // the boards a stage runs on
+};
+
+static StormProcess_tSTRIKE stage_strike;
+static StormProcess_tTIMESTAMPINFO stage_ts;
+
+static void
+Stage_Unpack(struct corpus *c, size_t i)
+{
+        StormProcess_UnpackCaptureData(&c->packed[i], &c->work[i]);
+        return;
+}
+
+static void
+Stage_GPS(struct corpus *c, size_t i)
+{
+        stage_ts = ExtractGPSData(&c->packed[i]);
+        return;
+}
+
+static void
+Stage_Filter(struct corpus *c, size_t i)
+{
+        Capture_Filter(&c->work[i]);
+        return;
+}
+
+static void
+Stage_Find_Peaks(struct corpus *c, size_t i)
+{
+        Capture_Find_Peaks(&c->work[i]);
+        return;
+}
+
+static void
+Stage_Valid(struct corpus *c, size_t i)
+{
+        c->reject[i] = Capture_Valid(&ctx->params, &c->work[i]);
+        return;
+}
+
+// Capture_ConvertToStrike, which is only run for the captures that pass
+static void
+Stage_Convert(struct corpus *c, size_t i)
+{
+        struct strike_geometry geom;
+
+        if (c->reject[i] != REJECT_NONE) return;
+        Capture_Geometry(ctx, &c->work[i], &geom);
+        geom.time = Average_Clock(&c->work[i].lts2_data);
+        stage_strike = Capture_Average(ctx, &geom);
+        return;
+}
+
+static void
+Stage_Process(struct corpus *c, size_t i)
+{
+        StormProcess_UnpackCaptureData(&c->packed[i], &c->work[i]);
+        stage_strike = StormProcess_SSProcessCaptureCtx(ctx, &c->work[i]);
+        return;
+}
+
+static void
+Stage_Process_Packed(struct corpus *c, size_t i)
+{
+        stage_strike = StormProcess_ProcessPacked(ctx, &c->packed[i]);
+        return;
+}
+
+struct stage
+{
+        const char *name;
+        int board;              // the BOARD_ each capture starts as, -1 for none
+        int strikes;            // counted per strike rather than per capture
+        void (*run)(struct corpus *c, size_t i);
+};
+
+static const struct stage stages[] =
+{
+        { "unpack", -1, 0, Stage_Unpack },
+        { "gps_decode", -1, 0, Stage_GPS },
+        { "filter", BOARD_UNPACKED, 0, Stage_Filter },
+        { "find_peaks", BOARD_FILTERED, 0, Stage_Find_Peaks },
+        { "valid", BOARD_PEAKS, 0, Stage_Valid },
+        { "convert", BOARD_CHECKED, 1, Stage_Convert },
+        { "process", -1, 0, Stage_Process },
+        { "process_packed", -1, 0, Stage_Process_Packed },
+};
+
+// the boards of every stage, from the packed captures - non-zero on success
+static int
+Corpus_Prepare(struct corpus *c)
+{
+        size_t i;
+        int b;
+
+        c->reject = calloc (c->count, sizeof(*c->reject));
+        c->work = calloc (c->count, sizeof(*c->work));
+        if (c->reject == NULL || c->work == NULL) return 0;
+        for (b = 0; b < BOARDS; b++)
+                if ((c->boards[b] = calloc (c->count, sizeof(*c->work))) == NULL)
+                        return 0;
+
+        c->valid = 0;
+        for (i = 0; i < c->count; i++)
+        {
+                StormProcess_UnpackCaptureData(&c->packed[i], &c->boards[BOARD_UNPACKED][i]);
+                c->boards[BOARD_FILTERED][i] = c->boards[BOARD_UNPACKED][i];
+                Capture_Filter(&c->boards[BOARD_FILTERED][i]);
+                c->boards[BOARD_PEAKS][i] = c->boards[BOARD_FILTERED][i];
+                Capture_Find_Peaks(&c->boards[BOARD_PEAKS][i]);
+                c->boards[BOARD_CHECKED][i] = c->boards[BOARD_PEAKS][i];
+                c->reject[i] = Capture_Valid(&ctx->params, &c->boards[BOARD_CHECKED][i]);
+                c->valid += c->reject[i] == REJECT_NONE;
+        }
+        return 1;
+}
+
+static void
+Corpus_Free(struct corpus *c)
+{
+        int b;
+
+        for (b = 0; b < BOARDS; b++)
+                free (c->boards[b]);
+        free (c->work);
+        free (c->reject);
+        free (c->packed);
+        return;
+}
+
+// a storm all round at up to 300 miles, arriving a thousand a second,
+// one capture in four noise
+static int
+Corpus_Synthetic(struct corpus *c, size_t count)
+{
+        StormProcess_tSYNTHPARAMS params;
+        StormProcess_Synth *synth;
+        size_t i;
+
+        c->name = "synthetic";
+        c->count = count;
+        c->packed = calloc (count, sizeof(*c->packed));
+        StormProcess_DefaultSynthParams(&params);
+        params.rate = 1000;
+        params.min_miles = 0;
+        params.max_miles = 300;
+        params.start_ns = 1700000000000000000LL;
+        synth = StormProcess_CreateSynth(ctx, &params);
+        if (c->packed == NULL || synth == NULL) return 0;
+        for (i = 0; i < count; i++)
+                StormProcess_SynthCapture(synth, &c->packed[i], NULL);
+        StormProcess_DestroySynth(synth);
+        return Corpus_Prepare(c);
+}
+
+// the first count captures of a capture file - non-zero on success
+static int
+Corpus_File(struct corpus *c, const char *filename, size_t count)
+{
+        FILE *file = fopen (filename, "rb");
+
+        c->name = "recorded";
+        if (file == NULL) return 0;
+        c->packed = calloc (count, sizeof(*c->packed));
+        c->count = c->packed ? fread (c->packed, sizeof(*c->packed), count, file) : 0;
+        fclose (file);
+        return c->count > 0 && Corpus_Prepare(c);
+}
+
+// ns and cycles per capture of a stage, over passes of the corpus
+static void
+Time_Stage(struct corpus *c, const struct stage *stage, long passes, double *ns, double *cycles)
+{
+        unsigned long long cycle_start, cycle_total = 0;
+        double start, total = 0;
+        long pass;
+        size_t i;
+
+        for (pass = -1; pass < passes; pass++)  /* one to warm up */
+        {
+                if (stage->board >= 0)
+                        memcpy (c->work, c->boards[stage->board], c->count * sizeof(*c->work));
+                start = Now ();
+                cycle_start = Cycles ();
+                for (i = 0; i < c->count; i++)
+                {
+                        stage->run (c, i);
+                        __asm__ volatile ("" : : "r" (c) : "memory");
+                }
+                if (pass < 0) continue;
+                cycle_total += Cycles () - cycle_start;
+                total += Now () - start;
+        }
+        *ns = total * 1e9 / passes;
+        *cycles = strcmp (cycles_source, "none") ? (double) cycle_total / passes : -1;
+        return;
+}
+
+static void
+Stage_Suite(struct corpus *c, long iterations)
+{
+        long passes = iterations / (long) c->count;
+        double ns, cycles;
+        size_t s, per;
+
+        if (passes < 1) passes = 1;
+        StormProcess_ResetAverages(ctx);
+        for (s = 0; s < sizeof(stages) / sizeof(stages[0]); s++)
+        {
+                per = stages[s].strikes ? c->valid : c->count;
+                if (per == 0) continue;
+                Time_Stage(c, &stages[s], passes, &ns, &cycles);
+                ns /= per;
+                cycles = cycles < 0 ? -1 : cycles / per;
+                fprintf (table, "%-14s %-10s %9zu %12.1f %12.0f %12.0f\n", stages[s].name, c->name,
+                         per, ns, 1e9 / ns, cycles);
+                if (json)
+                        printf ("{\"table\":\"stage\",\"stage\":\"%s\",\"corpus\":\"%s\",\"captures\":%zu,"
+                                "\"ns_per_capture\":%.1f,\"captures_per_s\":%.0f,\"cycles_per_capture\":%.0f,"
+                                "\"cycles\":\"%s\"}\n",
+                                stages[s].name, c->name, per, ns, 1e9 / ns, cycles, cycles_source);
+        }
+        return;
+}
+
+int main(int argc, char **argv)
+{
+        static const char *level_names[] = { "c", "sse2", "neon", "avx2" };
+        StormProcess_tBOARDDATA scalar;
+        struct corpus synthetic, recorded;
+        const char *filename = NULL;
+        long iterations = 200000, captures = 1000;
+        double c_ns, simd_ns, ns;
+        int level, opt;
+        size_t b, m;
+
+        table = stdout;
+        while ((opt = getopt (argc, argv, "jf:n:")) != -1)
+                switch (opt)
+                {
+                case 'j':
+                        json = 1;
+                        table = stderr;
+                        break;
+                case 'f':
+                        filename = optarg;
+                        break;
+                case 'n':
+                        captures = atol (optarg);
+                        break;
+                default:
+                        captures = 0;
+                }
+        if (optind < argc)
+                iterations = atol (argv[optind]);
+        if (iterations <= 0 || captures <= 0)
+        {
+                fprintf (stderr, "usage: %s [-j] [-f capturefile] [-n captures] [iterations]\n", argv[0]);
+                return 1;
+        }
+
+        ctx = StormProcess_DefaultContext();
+        MakeCapture();
+        Simd_Limit(SIMD_NONE);
+        scalar = board;
+        Capture_Find_Peaks(&scalar);
+        Simd_Limit(SIMD_AVX2);
+        level = Simd_Level();
+        Capture_Find_Peaks(&board);
+        if (memcmp (&scalar, &board, sizeof(board)))
+        {
+                fprintf (table, "%s kernels disagree with the C code\n", level_names[level]);
+                return 1;
+        }
+
+        fprintf (table, "%-14s %10s %10s %8s\n", "kernel", "c ns", level_names[level], "speedup");
+        for (b = 0; b < sizeof(benchmarks) / sizeof(benchmarks[0]); b++)
+        {
+                MakeCapture();
+                Simd_Limit(SIMD_NONE);
+                c_ns = Time(benchmarks[b].run, iterations);
+                Simd_Limit(SIMD_AVX2);
+                simd_ns = Time(benchmarks[b].run, iterations);
+                fprintf (table, "%-14s %10.1f %10.1f %7.2fx\n", benchmarks[b].name,
+                         c_ns, simd_ns, c_ns / simd_ns);
+                if (json)
+                        printf ("{\"table\":\"kernel\",\"kernel\":\"%s\",\"c_ns\":%.1f,\"simd\":\"%s\","
+                                "\"simd_ns\":%.1f}\n", benchmarks[b].name, c_ns, level_names[level], simd_ns);
+        }
+
+        fprintf (table, "\n");
+        for (b = 0; b < sizeof(math_modes) / sizeof(math_modes[0]); b++)
+                if (!Check_Geometry(&math_modes[b]) || !Check_Captures(&math_modes[b]))
+                {
+                        fprintf (table, "%s math is outside its error bounds\n", math_modes[b].name);
+                        return 1;
+                }
+        for (m = 0; m <= sizeof(math_modes) / sizeof(math_modes[0]); m++)
+                if (!Check_Paths(m ? math_modes[m - 1].math : STORMPROCESS_MATH_EXACT,
+                                 m ? math_modes[m - 1].name : "exact"))
+                {
+                        fprintf (table, "processing paths disagree\n");
+                        return 1;
+                }
+        fprintf (table, "\n%-14s %10s %10s %10s\n", "math ns", "exact", math_modes[0].name, math_modes[1].name);
+        for (b = 0; b < sizeof(math_benchmarks) / sizeof(math_benchmarks[0]); b++)
+        {
+                fprintf (table, "%-14s", math_benchmarks[b].name);
+                for (m = 0; m <= sizeof(math_modes) / sizeof(math_modes[0]); m++)
+                {
+                        StormProcess_SetMath(ctx, m ? math_modes[m - 1].math : STORMPROCESS_MATH_EXACT);
+                        ns = Time(math_benchmarks[b].run, iterations);
+                        fprintf (table, " %10.1f", ns);
+                        if (json)
+                                printf ("{\"table\":\"math\",\"kernel\":\"%s\",\"math\":\"%s\",\"ns\":%.1f}\n",
+                                        math_benchmarks[b].name, m ? math_modes[m - 1].name : "exact", ns);
+                }
+                fprintf (table, "\n");
+        }
+        StormProcess_SetMath(ctx, STORMPROCESS_MATH_EXACT);
+
+        Cycles_Open();
+        fprintf (table, "\n%-14s %-10s %9s %12s %12s %12s\n", "stage", "corpus", "captures",
+                 "ns/capture", "captures/s", "cycles");
+        if (!Corpus_Synthetic(&synthetic, captures))
+        {
+                fprintf (table, "no memory for %ld captures\n", captures);
+                return 1;
+        }
+        Stage_Suite(&synthetic, iterations);
+        Corpus_Free(&synthetic);
+        if (filename)
+        {
+                memset (&recorded, 0, sizeof(recorded));
+                if (!Corpus_File(&recorded, filename, captures))
+                {
+                        fprintf (table, "can't read captures from %s\n", filename);
+                        return 1;
+                }
+                Stage_Suite(&recorded, iterations);
+                Corpus_Free(&recorded);
+        }
+        return 0;
+}
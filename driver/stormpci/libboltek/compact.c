@@ -0,0 +1,228 @@
+/* Compact capture layout for the Boltek Lightning Detector SDK
+   StormProcess_tBOARDDATA2 keeps the samples in 16 bits, the E-field as
+   a bitset and the GPS data in the packed capture it was unpacked from,
+   about 2KB against 6KB for StormProcess_tBOARDDATA. Processing it gives
+   the same strikes as the original layout.
+*/
+
+#include <string.h>
+
+#include "stormpci.h"
+#include "stormpci_int.h"
+
+#define EFIELD_BIT(n)   (1u << ((n) & 31))
+#define EFIELD(capture, n)  (((capture)->EFieldBits[(n) >> 5] >> ((n) & 31)) & 1)
+
+
+void
+StormProcess_UnpackCaptureData2(const StormProcess_tPACKEDDATA *packed_data, StormProcess_tBOARDDATA2 *board_data)
+{
+        __u32 bits;
+        int cnt;
+
+        for (cnt = 0; cnt < BOLTEK_BUFFERSIZE; cnt++)
+        {
+                board_data->NorthBuf[cnt] = packed_data->usNorth[cnt] & 0xff;
+                board_data->EastBuf[cnt] = packed_data->usWest[cnt] & 0xff;
+        }
+        for (cnt = 0; cnt < BOLTEK_BUFFERSIZE; cnt += 32)
+        {
+                int n;
+
+                bits = 0;
+                for (n = 0; n < 32; n++)
+                        bits |= (__u32) ((packed_data->usNorth[cnt + n] >> 8) & 1) << n;
+                board_data->EFieldBits[cnt >> 5] = bits;
+        }
+        board_data->packed = packed_data;
+        return;
+}
+
+// the timestamp and GPS data, decoded from the packed capture
+StormProcess_tTIMESTAMPINFO
+StormProcess_Timestamp2(const StormProcess_tBOARDDATA2 *capture)
+{
+        StormProcess_tTIMESTAMPINFO none;
+
+        if (capture->packed) return ExtractGPSData(capture->packed);
+        memset (&none, 0, sizeof(none));
+        return none;
+}
+
+// samples and results of an original layout capture. There is no packed
+// capture to refer to, so the GPS data is left behind
+void
+StormProcess_ConvertToBoardData2(const StormProcess_tBOARDDATA *from, StormProcess_tBOARDDATA2 *to)
+{
+        int cnt;
+
+        memset (to->EFieldBits, 0, sizeof(to->EFieldBits));
+        for (cnt = 0; cnt < BOLTEK_BUFFERSIZE; cnt++)
+        {
+                to->NorthBuf[cnt] = from->NorthBuf[cnt];
+                to->EastBuf[cnt] = from->EastBuf[cnt];
+                if (from->EFieldBuf[cnt])
+                        to->EFieldBits[cnt >> 5] |= EFIELD_BIT(cnt);
+        }
+        to->packed = NULL;
+        to->NorthMaxPos = from->NorthMaxPos;
+        to->NorthMinPos = from->NorthMinPos;
+        to->EastMaxPos = from->EastMaxPos;
+        to->EastMinPos = from->EastMinPos;
+        to->North_Pk = from->North_Pk;
+        to->East_Pk = from->East_Pk;
+        to->NorthPol = from->NorthPol;
+        to->EastPol = from->EastPol;
+        to->EFieldPol = from->EFieldPol;
+        return;
+}
+
+void
+StormProcess_ConvertFromBoardData2(const StormProcess_tBOARDDATA2 *from, StormProcess_tBOARDDATA *to)
+{
+        int cnt;
+
+        for (cnt = 0; cnt < BOLTEK_BUFFERSIZE; cnt++)
+        {
+                to->NorthBuf[cnt] = from->NorthBuf[cnt];
+                to->EastBuf[cnt] = from->EastBuf[cnt];
+                to->EFieldBuf[cnt] = EFIELD(from, cnt);
+        }
+        to->lts2_data = StormProcess_Timestamp2(from);
+        to->NorthMaxPos = from->NorthMaxPos;
+        to->NorthMinPos = from->NorthMinPos;
+        to->EastMaxPos = from->EastMaxPos;
+        to->EastMinPos = from->EastMinPos;
+        to->North_Pk = from->North_Pk;
+        to->East_Pk = from->East_Pk;
+        to->NorthPol = from->NorthPol;
+        to->EastPol = from->EastPol;
+        to->EFieldPol = from->EFieldPol;
+        return;
+}
+
+
+// Capture_Filter on 16 bit samples, the sums stay within MAXBUFVAL
+static void
+Capture2_Filter(StormProcess_tBOARDDATA2 *capture)
+{
+        __u16 *north = capture->NorthBuf, *east = capture->EastBuf;
+        int X;
+
+        for (X = 0; X < BOLTEK_BUFFERSIZE - 4; X++)
+        {
+                north[X] = north[X] + north[X + 1] + north[X + 2] + north[X + 3];
+                east[X] = east[X] + east[X + 1] + east[X + 2] + east[X + 3];
+        }
+        /*  Now take care of the last few  */
+        X = BOLTEK_BUFFERSIZE - 4;
+        north[X] = north[X] + north[X + 1] + north[X + 2] + north[X + 3];
+        north[X + 1] = north[X + 2] = north[X + 3] = north[X];
+        east[X] = east[X] + east[X + 1] + east[X + 2] + east[X + 3];
+        east[X + 1] = east[X + 2] = east[X + 3] = east[X];
+        return;
+}
+
+// Peaks_Scan_C on 16 bit samples
+static void
+Peaks_Scan16(const __u16 *buf, struct peak_scan *scan)
+{
+        int Count;
+
+        scan->max = 0;
+        scan->min = 32000;
+        scan->max_pos = scan->min_pos = 3;
+        scan->clip_pos = scan->clip_neg = 0;
+        for (Count = 3; Count < BOLTEK_BUFFERSIZE; Count++)
+        {
+                if (buf[Count] > scan->max)
+                {
+                        scan->max = buf[Count];
+                        scan->max_pos = Count;
+                }
+                if (buf[Count] < scan->min)
+                {
+                        scan->min = buf[Count];
+                        scan->min_pos = Count;
+                }
+                scan->clip_pos += buf[Count] == MAXBUFVAL;
+                scan->clip_neg += buf[Count] == 0;
+        }
+        return;
+}
+
+static void
+Capture2_Find_Peaks(StormProcess_tBOARDDATA2 *capture, struct capture_peaks *peaks)
+{
+        struct peak_scan north, east;
+        int other_pk;
+
+        Peaks_Scan16(capture->NorthBuf, &north);
+        Peaks_Scan16(capture->EastBuf, &east);
+        Peaks_Positions(&north, &east, peaks);
+        if (Peaks_NorthWins(&north, &east))
+                other_pk = capture->EastBuf[peaks->NorthMaxPos] - capture->EastBuf[peaks->NorthMinPos];
+        else
+                other_pk = capture->NorthBuf[peaks->EastMaxPos] - capture->NorthBuf[peaks->EastMinPos];
+        Peaks_Resolve(&north, &east, other_pk, peaks);
+
+        capture->NorthMaxPos = peaks->NorthMaxPos;
+        capture->NorthMinPos = peaks->NorthMinPos;
+        capture->EastMaxPos = peaks->EastMaxPos;
+        capture->EastMinPos = peaks->EastMinPos;
+        capture->North_Pk = peaks->North_Pk;
+        capture->East_Pk = peaks->East_Pk;
+        return;
+}
+
+static int
+Capture2_Valid(const StormProcess_tPARAMS *params, StormProcess_tBOARDDATA2 *capture,
+               const struct capture_peaks *peaks)
+{
+        struct capture_pol pol;
+        int reject;
+
+        reject = Valid_Decide(params, peaks,
+                              EFIELD(capture, Valid_EFieldPos(params, peaks->NorthMinPos)),
+                              EFIELD(capture, Valid_EFieldPos(params, peaks->NorthMaxPos)),
+                              EFIELD(capture, Valid_EFieldPos(params, peaks->EastMinPos)),
+                              EFIELD(capture, Valid_EFieldPos(params, peaks->EastMaxPos)),
+                              &pol);
+        capture->NorthPol = pol.NorthPol;
+        capture->EastPol = pol.EastPol;
+        capture->EFieldPol = pol.EFieldPol;
+        return reject;
+}
+
+
+//==================================================================
+// StormProcess_SSProcessCaptureCtx for the compact layout, the same
+// strike from the same capture
+//
+StormProcess_tSTRIKE
+StormProcess_SSProcessCapture2Ctx(StormProcess_Context *ctx, StormProcess_tBOARDDATA2 *capture)
+{
+        struct capture_peaks peaks;
+        struct strike_geometry geom;
+        StormProcess_tTIMESTAMPINFO ts;
+        StormProcess_tSTRIKE strike;
+
+        Capture2_Filter(capture);
+        Capture2_Find_Peaks(capture, &peaks);
+        if (Capture_Count(ctx, Capture2_Valid(&ctx->params, capture, &peaks)))
+                return Capture_Rejected();
+
+        Geometry_Strike(ctx, capture->North_Pk, capture->East_Pk,
+                        capture->NorthPol, capture->EastPol, &geom);
+        ts = StormProcess_Timestamp2(capture);
+        geom.time = Average_Clock(&ts);
+        strike = Capture_Average(ctx, &geom);
+        strike.valid = 1;
+        return strike;
+}
+
+StormProcess_tSTRIKE
+StormProcess_SSProcessCapture2(StormProcess_tBOARDDATA2 *capture)
+{
+        return StormProcess_SSProcessCapture2Ctx(StormProcess_DefaultContext(), capture);
+}
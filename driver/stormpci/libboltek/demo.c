@@ -4,6 +4,7 @@
 /* Rev 1.0 - July 27 2008 */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <unistd.h>
 #include <time.h>
 
@@ -12,33 +13,104 @@
 //#define SIMULATE_HIT 1
 #define POLL_INTERVAL_SECONDS  15
 
-int main()
+static void usage(const char *prog)
 {
-        int ready, i, j;
-        StormProcess_tPACKEDDATA packed_info;
+        printf ("usage: %s [-c card | -f capturefile [-p]] [-w capturefile] [-a]\n", prog);
+        printf ("  -a  adapt the squelch to the noise\n");
+        printf ("  -c  read from card N, /dev/lightning-N, instead of card 0\n");
+        printf ("  -f  replay captures from a file instead of the card\n");
+        printf ("  -p  replay at the original GPS timestamp pacing\n");
+        printf ("  -w  append every capture to a file\n");
+        exit (1);
+}
+
+int main(int argc, char **argv)
+{
+        int ready, opt, replay_flags = 0, card = -1;
+        const char *replay_file = NULL;
+        FILE *record = NULL;
+        const StormProcess_tPACKEDDATA *packed_info;
         StormProcess_tBOARDDATA  unpacked_info;
         StormProcess_tSTRIKE strike;
+        StormPCI_Squelch *squelch = NULL;
+        StormPCI_tSQUELCHEVENT event;
+        int adaptive = 0, captured;
         time_t now;
+
+        while ((opt = getopt (argc, argv, "c:f:pw:a")) != -1)
+        {
+                switch (opt)
+                {
+                case 'a':
+                        adaptive = 1;
+                        break;
+                case 'c':
+                        card = atoi (optarg);
+                        break;
+                case 'f':
+                        replay_file = optarg;
+                        break;
+                case 'p':
+                        replay_flags |= STORMPCI_REPLAY_PACED;
+                        break;
+                case 'w':
+                        record = fopen (optarg, "ab");
+                        if (record == NULL)
+                        {
+                                perror (optarg);
+                                return 1;
+                        }
+                        break;
+                default:
+                        usage (argv[0]);
+                }
+        }
+
+        if (replay_file && !StormPCI_UseReplayFile (replay_file, replay_flags))
+        {
+                printf ("Cannot replay %s\n", replay_file);
+                return 1;
+        }
         
+        if (card >= 0 && !replay_file && !StormPCI_UseCard (card))
+        {
+                printf ("No such card %d\n", card);
+                return 1;
+        }
+
         if (StormPCI_OpenPciCard())
         {
                 // squelch is from 0 to 15, with 0 as most sensitive (and default)
                 StormPCI_SetSquelch (0);
+                if (adaptive)
+                {
+                        squelch = StormPCI_CreateSquelch (StormPCI_DefaultContext (), NULL);
+                        if (squelch == NULL)
+                                printf ("Can't adapt the squelch, another reader owns it\n");
+                }
                 
                 while (1)
                 {
+                        captured = 0;
 #if SIMULATE_HIT
                         // to simulate a hit use
                         StormPCI_ForceTrigger(); sleep(1);
 #endif                   
-                        ready = StormPCI_StrikeReady();
-                        if (ready)
+                        ready = StormPCI_WaitForStrike(POLL_INTERVAL_SECONDS * 1000);
+                        if (ready && (packed_info = StormPCI_PeekCapture()) != NULL)
                         {
+                                captured = 1;
                                 time(&now);
-                                StormPCI_GetBoardData(&packed_info);
-                                StormPCI_RestartBoard();
 
-                                StormProcess_UnpackCaptureData(&packed_info, &unpacked_info);
+                                if (record)
+                                {
+                                        fwrite (packed_info, sizeof(*packed_info), 1, record);
+                                        fflush (record);
+                                }
+
+                                // unpack straight from the driver's ring, then hand the slot back
+                                StormProcess_UnpackCaptureData(packed_info, &unpacked_info);
+                                StormPCI_ReleaseCapture();
                                 strike = StormProcess_SSProcessCapture(&unpacked_info);
                                 
                                 if (strike.valid)
@@ -54,11 +126,16 @@ int main()
                                         printf ("-");
                                 
                         }
+                        else if (StormPCI_Exhausted())
+                                break; // replay has run dry
                         else
                                 printf (".");
+
+                        if (squelch && StormPCI_SquelchUpdate (squelch, captured ? &strike : NULL, -1, &event))
+                                printf ("\nSquelch %d -> %d (%.0f%% strikes, %.1f triggers/s)\n",
+                                        event.old_level, event.new_level,
+                                        event.valid_ratio * 100, event.trigger_rate);
                         fflush (stdout);
-                        
-                        sleep (POLL_INTERVAL_SECONDS);
                 }
         }
         else
@@ -66,6 +143,7 @@ int main()
                 printf ("Cannot Access Boltek Lightning Detector\n");
         }
         
+        StormPCI_DestroySquelch(squelch);
         StormPCI_ClosePciCard(); 
 
         return 0;
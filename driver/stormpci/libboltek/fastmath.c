@@ -0,0 +1,95 @@
+/* Fast strike geometry for the Boltek Lightning Detector SDK
+   Geometry_FromPeaks in single precision without libm, for
+   STORMPROCESS_MATH_FAST. The divisor (N*N + E*E)^3/4 cancels out of
+   the bearing and leaves the distance as (N*N + E*E)^-1/4, which is two
+   reciprocal square roots; the bearing is a polynomial arctangent.
+   Against the double precision reference, for every North_Pk and
+   East_Pk up to 2047 with the default params (bench checks these):
+
+   bearing            within 0.0005 degrees (3e-5 measured)
+   distance           within 2 parts in 10^5 before suck-in (7e-6), and
+                      within 0.005 miles for strikes inside miles_scale
+                      (0.0021)
+*/
+
+#include <string.h>
+
+#include "stormpci.h"
+#include "stormpci_int.h"
+
+#define DEGREES_PER_RADIAN 57.296f      /*  as the reference  */
+#define HALF_PI 1.57079633f
+
+// 1/sqrt(x): the integer estimate and two Newton steps, for x > 0
+static inline float
+Fast_Rsqrt(float x)
+{
+        __u32 bits;
+        float y;
+
+        memcpy (&bits, &x, sizeof(bits));
+        bits = 0x5f3759df - (bits >> 1);
+        memcpy (&y, &bits, sizeof(y));
+        y = y * (1.5f - 0.5f * x * y * y);
+        y = y * (1.5f - 0.5f * x * y * y);
+        return y;
+}
+
+// atan(t) for -1 <= t <= 1, Abramowitz and Stegun 4.4.47
+static inline float
+Fast_Atan1(float t)
+{
+        float t2 = t * t;
+
+        return t * (0.9999993329f + t2 * (-0.3332985605f + t2 * (0.1994653599f + t2 * (-0.1390853351f +
+                    t2 * (0.0964200441f + t2 * (-0.0559098861f + t2 * (0.0218612288f + t2 * -0.0040540580f)))))));
+}
+
+static inline float
+Fast_Atan(float t)
+{
+        if (t > 1.0f) return HALF_PI - Fast_Atan1(1.0f / t);
+        if (t < -1.0f) return -HALF_PI - Fast_Atan1(1.0f / t);
+        return Fast_Atan1(t);
+}
+
+void
+Geometry_Fast(const StormProcess_tPARAMS *params, int North_Pk, int East_Pk,
+              int NorthPol, int EastPol, struct strike_geometry *geom)
+{
+        float SuckSubtract = params->r_screen_limit * params->suckin;
+        float north = NorthPol * (float) North_Pk, east = EastPol * (float) East_Pk;
+        float q = north * north + east * east;
+        float r, Distance, New_Distance, d_bearing;
+
+        /*  no signal at all, the reference has a case of its own for that  */
+        if (q == 0.0f)
+        {
+                Geometry_FromPeaks(params, North_Pk, East_Pk, NorthPol, EastPol, geom);
+                return;
+        }
+
+        /*  Distance = sqrt(q) / q^3/4  */
+        r = Fast_Rsqrt(q);
+        Distance = r * Fast_Rsqrt(r);
+
+        /*  R_YValue / R_XValue = north / east  */
+        if (east != 0.0f)
+                d_bearing = 180.0f + DEGREES_PER_RADIAN * Fast_Atan(north / east);
+        else
+                d_bearing = north > 0.0f ? 270.0f : 90.0f;
+        if (d_bearing > 359.0f || d_bearing < 0.0f)
+                d_bearing = 359.0f;
+
+        /*  NOW SUCK IN THE CENTER OF THE SCREEN  */
+        New_Distance = Distance - SuckSubtract;
+        if (New_Distance < 0.0f) New_Distance = 0.0f;
+        New_Distance = New_Distance * (float) (params->r_screen_limit / (params->r_screen_limit - SuckSubtract));
+
+        /*  R_X, R_Y = east, north / q^3/4, moved to New_Distance  */
+        geom->R_XValue = east * r * New_Distance;
+        geom->R_YValue = north * r * New_Distance;
+        geom->New_Distance = New_Distance;
+        geom->d_bearing = d_bearing;
+        return;
+}
@@ -0,0 +1,287 @@
+/* Timestamp and GPS decoding for the Boltek Lightning Detector SDK
+   The high bytes of usWest carry a 10 byte timestamp block, different
+   for every strike, followed by a 157 byte record from the GPS receiver
+   that only changes once a second. The two are decoded separately and
+   the last GPS record each thread decoded is kept, so a burst of
+   captures from one second decodes it once.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+
+#include "stormpci.h"
+#include "stormpci_int.h"
+
+#define TS_BYTES 10             /*  timestamp block, from usWest[0]  */
+#define GPS_BYTES 157           /*  GPS record, after the timestamp  */
+#define GPS_CHECKSUM 151        /*  XOR of record bytes 2..149  */
+#define GPS_SATELLITES 57       /*  12 entries of 6 bytes  */
+#define GPS_SATELLITE_BYTES 6
+
+// the GPS fields of StormProcess_tTIMESTAMPINFO, gps_data_valid onwards
+#define GPS_FIELDS offsetof(StormProcess_tTIMESTAMPINFO, gps_data_valid)
+#define GPS_FIELDS_SIZE (sizeof(StormProcess_tTIMESTAMPINFO) - GPS_FIELDS)
+
+//==================================================================
+// Record layouts. F(field, offset, type) stores one field, decoded from
+// the bytes at offset as type, and the lists expand to straight-line
+// code in the Decode_ functions. A receiver with another record layout
+// needs another list and its own Decode_ function.
+//
+#define TIMESTAMP_FIELDS(F) \
+        F(TS_10ms, 0, U8) \
+        F(TS_time, 1, LE32) \
+        F(TS_Osc, 5, LE32)
+
+#define GPS_RECORD_FIELDS(F) \
+        F(month, 4, U8) \
+        F(day, 5, U8) \
+        F(year, 6, BE16) \
+        F(hours, 8, U8) \
+        F(minutes, 9, U8) \
+        F(seconds, 10, U8) \
+        F(latitude_mas, 15, BE32) \
+        F(longitude_mas, 19, BE32) \
+        F(height_cm, 23, BE32) \
+        F(dop, 53, BE16) \
+        F(satellites_visible, 55, U8) \
+        F(satellites_tracked, 56, U8) \
+        F(receiver_status, 129, BE16) \
+        F(oscillator_temperature, 139, BE16_HALF) \
+        F(serial_number, 155, BE16)
+
+// each of the satellite entries, relative to its first byte
+#define GPS_SATELLITE_FIELDS(F) \
+        F(SVID, 0, U8) \
+        F(mode, 1, U8) \
+        F(signal_strength, 2, U8) \
+        F(channel_status, 4, BE16)
+
+#define STORE_FIELD(field, offset, type)  out->field = LOAD_##type(rec + (offset));
+
+#define LOAD_U8(p) (*(p))
+#define LOAD_BE16(p) Load_BE16(p)
+#define LOAD_BE16_HALF(p) (Load_BE16(p) >> 1)     /*  half degrees to degrees C  */
+#define LOAD_BE32(p) Load_BE32(p)
+#define LOAD_LE32(p) Load_LE32(p)
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define FROM_BE16(v) __builtin_bswap16 (v)
+#define FROM_BE32(v) __builtin_bswap32 (v)
+#define FROM_LE32(v) (v)
+#else
+#define FROM_BE16(v) (v)
+#define FROM_BE32(v) (v)
+#define FROM_LE32(v) __builtin_bswap32 (v)
+#endif
+
+static inline unsigned
+Load_BE16(const unsigned char *p)
+{
+        __u16 v;
+
+        memcpy (&v, p, sizeof(v));
+        return FROM_BE16 (v);
+}
+
+// the 32 bit fields are signed, as the byte arithmetic they replace was
+static inline __s32
+Load_BE32(const unsigned char *p)
+{
+        __u32 v;
+
+        memcpy (&v, p, sizeof(v));
+        return (__s32) FROM_BE32 (v);
+}
+
+static inline __s32
+Load_LE32(const unsigned char *p)
+{
+        __u32 v;
+
+        memcpy (&v, p, sizeof(v));
+        return (__s32) FROM_LE32 (v);
+}
+
+// XOR of n bytes, eight at a time
+static unsigned char
+Checksum_Xor(const unsigned char *p, int n)
+{
+        __u64 word, acc = 0;
+        unsigned char checksum = 0;
+
+        for (; n >= 8; p += 8, n -= 8)
+        {
+                memcpy (&word, p, sizeof(word));
+                acc ^= word;
+        }
+        for (; n > 0; n--)
+                checksum ^= *p++;
+        acc ^= acc >> 32;
+        acc ^= acc >> 16;
+        acc ^= acc >> 8;
+        return checksum ^ (unsigned char) acc;
+}
+
+
+// the last GPS record decoded on this thread, found by its checksum
+// byte and confirmed against the whole record
+struct gps_cache
+{
+        int valid;
+        unsigned char record[GPS_BYTES];
+        StormProcess_tTIMESTAMPINFO tgps;
+};
+
+static __thread struct gps_cache gps_cache;
+
+
+static inline void
+Decode_Timestamp(const unsigned char *rec, StormProcess_tTIMESTAMPINFO *out)
+{
+        TIMESTAMP_FIELDS(STORE_FIELD)
+        return;
+}
+
+static inline void
+Decode_Satellite(const unsigned char *rec, struct StormProcess_tSATELLITETYPE *out)
+{
+        GPS_SATELLITE_FIELDS(STORE_FIELD)
+        return;
+}
+
+static void
+Decode_GPS(const unsigned char *rec, StormProcess_tTIMESTAMPINFO *out)
+{
+        int cnt;
+
+        GPS_RECORD_FIELDS(STORE_FIELD)
+        for (cnt = 0; cnt < 12; cnt++)
+                Decode_Satellite(rec + GPS_SATELLITES + cnt * GPS_SATELLITE_BYTES, &out->satellite[cnt]);
+
+        // Is the GPS data valid?
+        out->gps_data_valid = Checksum_Xor(rec + 2, 148) == rec[GPS_CHECKSUM];
+
+        if (out->latitude_mas < 0)
+        {
+                out->latitude_mas = abs (out->latitude_mas);
+                out->latitude_ns = 'S';
+        }
+        else
+                out->latitude_ns = 'N';
+
+        if (out->longitude_mas < 0)
+        {
+                out->longitude_mas = abs (out->longitude_mas);
+                out->longitude_ew = 'W';
+        }
+        else
+                out->longitude_ew = 'E';
+        return;
+}
+
+
+// the TS_ fields of tgps, the others are left alone
+void
+Extract_Timestamp(const StormProcess_tPACKEDDATA *packeddata, StormProcess_tTIMESTAMPINFO *tgps)
+{
+        unsigned char tsdata[TS_BYTES];
+        unsigned char checksum = 0;
+        int cnt;
+
+        for (cnt = 0; cnt < TS_BYTES; cnt++)
+                tsdata[cnt] = packeddata->usWest[cnt] >> 8;
+
+        // Is the TS data valid?
+        for (cnt = 0; cnt < 9; cnt++)
+                checksum += tsdata[cnt];
+        tgps->TS_valid = checksum == tsdata[8];
+
+        Decode_Timestamp(tsdata, tgps);
+        tgps->capture_time = 0;
+        return;
+}
+
+// the GPS fields of tgps, from gps_data_valid on. Decoded only when the
+// record differs from the last one this thread saw
+void
+Extract_GPS(const StormProcess_tPACKEDDATA *packeddata, StormProcess_tTIMESTAMPINFO *tgps)
+{
+        struct gps_cache *cache = &gps_cache;
+        unsigned char gpsdata[GPS_BYTES];
+
+        Gather_High(&packeddata->usWest[TS_BYTES], gpsdata, GPS_BYTES);
+        if (!cache->valid || cache->record[GPS_CHECKSUM] != gpsdata[GPS_CHECKSUM] ||
+            memcmp (cache->record, gpsdata, GPS_BYTES))
+        {
+                Decode_GPS(gpsdata, &cache->tgps);
+                memcpy (cache->record, gpsdata, GPS_BYTES);
+                cache->valid = 1;
+        }
+        memcpy ((char *) tgps + GPS_FIELDS, (char *) &cache->tgps + GPS_FIELDS, GPS_FIELDS_SIZE);
+        return;
+}
+
+StormProcess_tTIMESTAMPINFO
+ExtractGPSData(const StormProcess_tPACKEDDATA *packeddata)
+{
+        StormProcess_tTIMESTAMPINFO tgps;
+
+        Extract_Timestamp(packeddata, &tgps);
+        Extract_GPS(packeddata, &tgps);
+        return tgps;
+}
+
+// days since 1970-01-01 of a proleptic gregorian date
+static long
+DaysFromCivil(int year, int month, int day)
+{
+        int era, yoe, doy, doe;
+
+        year -= month <= 2;
+        era = (year >= 0 ? year : year - 399) / 400;
+        yoe = year - era * 400;
+        doy = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+        doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+        return (long) era * 146097 + doe - 719468;
+}
+
+// seconds since the epoch the capture was triggered at, non-zero if the
+// timestamp and the GPS date are there to tell
+int
+Timestamp_Seconds(const StormProcess_tTIMESTAMPINFO *ts, double *seconds)
+{
+        if (!ts->TS_valid || !ts->gps_data_valid) return 0;
+        *seconds = DaysFromCivil(ts->year, ts->month, ts->day) * 86400.0 +
+                ts->hours * 3600 + ts->minutes * 60 + ts->seconds +
+                ts->TS_time / 1e9;
+        return 1;
+}
+
+// the same in whole milliseconds, without floating point
+int
+Timestamp_Millis(const StormProcess_tTIMESTAMPINFO *ts, long long *ms)
+{
+        if (!ts->TS_valid || !ts->gps_data_valid) return 0;
+        *ms = DaysFromCivil(ts->year, ts->month, ts->day) * 86400000LL +
+                (ts->hours * 3600 + ts->minutes * 60 + ts->seconds) * 1000LL +
+                ts->TS_time / 1000000;
+        return 1;
+}
+
+
+// public wrappers, see stormpci.h
+void
+StormProcess_DecodeTimestamp(const StormProcess_tPACKEDDATA *packed_data, StormProcess_tTIMESTAMPINFO *info)
+{
+        Extract_Timestamp(packed_data, info);
+        return;
+}
+
+void
+StormProcess_DecodeGPS(const StormProcess_tPACKEDDATA *packed_data, StormProcess_tTIMESTAMPINFO *info)
+{
+        Extract_GPS(packed_data, info);
+        return;
+}
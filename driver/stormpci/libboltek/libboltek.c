@@ -9,66 +9,734 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <poll.h>
+#include <errno.h>
 #include <linux/types.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 #include <math.h>
+#include <stdio.h>
 
 #include "stormpci.h"
+#include "stormpci_int.h"
 
 #define BOLTEK_IOCTL_RESTART		_IO  (0xEA, 0xA0)
 #define BOLTEK_IOCTL_FORCE_TRIGGER	_IO  (0xEA, 0xA1)
 #define BOLTEK_IOCTL_STRIKE_READY	_IOR (0xEA, 0xA2, __u8)
 #define BOLTEK_IOCTL_GET_DATA	        _IOR (0xEA, 0xA3, struct stormpci_packed_data)
 #define BOLTEK_IOCTL_SET_SQUELCH        _IOW (0xEA, 0xA4, __u8)
+#define BOLTEK_IOCTL_GET_VERSION        _IOR (0xEA, 0xA5, __u16)
+#define BOLTEK_IOCTL_GET_DATA_AND_RESTART _IOR (0xEA, 0xA7, struct stormpci_capture)
+#define BOLTEK_IOCTL_SET_CURSOR         _IOW (0xEA, 0xA8, __u64)
+
+#define BOLTEK_ABI_POLL         2       /*  first driver that wakes up poll()  */
+#define BOLTEK_ABI_RING         3       /*  captures queued, RESTART is a no-op  */
+#define BOLTEK_ABI_MMAP         4       /*  the capture ring can be mmap()ed  */
+#define BOLTEK_ABI_CAPTURE_INFO 5       /*  GET_DATA_AND_RESTART, ring info_offset  */
+#define BOLTEK_ABI_SHARED       6       /*  many readers, read-only ring with per-reader cursors  */
+
+/* The first page of the driver's mmap()ed capture ring. The driver
+   fills the slot at head and then advances it, wrapping at entries.
+   Up to ABI 5 we advance tail once done with a slot; from ABI 6 the
+   ring is read-only, the driver overwrites the oldest capture and
+   capture n lives in slot (n - 1) % entries. */
+#define BOLTEK_RING_VERSION 1
+struct boltek_ring_header
+{
+        __u32 version;
+        __u32 entries;
+        __u32 entry_size;
+        __u32 data_offset;
+        __u32 head;
+        __u32 tail;
+        __u32 overruns;
+        __u32 info_offset;      /*  ABI 5, entries struct stormpci_capture_info  */
+        __u32 seq;              /*  ABI 6, low 32 bits of the newest seq  */
+};
+
+struct stormpci_capture_info
+{
+        __u64 seq;
+        __s64 timestamp_ns;
+        __u32 missed;
+        __u32 reserved;
+};
+
+/* BOLTEK_IOCTL_GET_DATA_AND_RESTART */
+struct stormpci_capture
+{
+        struct stormpci_capture_info info;
+        StormProcess_tPACKEDDATA data;
+};
 
-static int fd = -1;
+
+// capture info for sources that can't tell: numbered in the order
+// the captures were read, stamped with the time they were read
+static void
+CaptureInfo_Synthesize(unsigned long long *sequence, StormPCI_tCAPTUREINFO *info)
+{
+        struct timespec ts;
+
+        clock_gettime (CLOCK_MONOTONIC, &ts);
+        info->sequence = ++*sequence;
+        info->timestamp_ns = ts.tv_sec * 1000000000LL + ts.tv_nsec;
+        info->missed = 0;
+        return;
+}
+
+static void
+CaptureInfo_FromDriver(const struct stormpci_capture_info *from, StormPCI_tCAPTUREINFO *info)
+{
+        info->sequence = from->seq;
+        info->timestamp_ns = from->timestamp_ns;
+        info->missed = from->missed;
+        return;
+}
 
 typedef int bool;
 #define false 0
 #define true 1
 
 
-// connect to the StormTracker card - non-zero on success
-int StormPCI_OpenPciCard()
+//==================================================================
+// The device backend: the real card, driven through the boltek.ko ioctls
+// priv is the struct device_source embedded in the owning context
+//
+static const StormPCI_tBACKEND device_backend;
+
+// seq of the newest capture in a shared ring, 0 if there is none yet
+static unsigned long long
+Device_NewestSeq(struct device_source *dev)
 {
-        int lfd;
+        __u32 entries = dev->ring->entries;
+        __u32 head = __atomic_load_n (&dev->ring->head, __ATOMIC_ACQUIRE);
+
+        return __atomic_load_n (&dev->infos[(head + entries - 1) % entries].seq, __ATOMIC_ACQUIRE);
+}
+
+// map the driver's capture ring, the ioctls are used if this fails
+static void
+Device_MapRing(struct device_source *dev, int writable)
+{
+        struct boltek_ring_header *hdr;
+        long pagesize = sysconf (_SC_PAGESIZE);
+        size_t len, info_len, info_offset = 0;
+        int shared = dev->abi_version >= BOLTEK_ABI_SHARED;
+
+        /* before ABI 6 we own the ring and write its tail */
+        if (dev->abi_version < BOLTEK_ABI_MMAP || (!shared && !writable)) return;
+
+        hdr = mmap (NULL, pagesize, PROT_READ, MAP_SHARED, dev->fd, 0);
+        if (hdr == MAP_FAILED) return;
+        len = 0;
+        info_len = 0;
+        if (hdr->version == BOLTEK_RING_VERSION &&
+            hdr->entry_size == sizeof(StormProcess_tPACKEDDATA) &&
+            hdr->entries > 1 && hdr->data_offset >= sizeof(*hdr))
+        {
+                len = hdr->data_offset + (size_t) hdr->entries * hdr->entry_size;
+                if (dev->abi_version >= BOLTEK_ABI_CAPTURE_INFO && hdr->info_offset)
+                {
+                        info_offset = hdr->info_offset;
+                        info_len = info_offset + hdr->entries * sizeof(struct stormpci_capture_info);
+                        if (info_len > len) len = info_len;
+                }
+        }
+        munmap (hdr, pagesize);
+        if (len == 0 || (shared && info_len == 0)) return;
+
+        hdr = mmap (NULL, len, shared ? PROT_READ : PROT_READ | PROT_WRITE, MAP_SHARED, dev->fd, 0);
+        if (hdr == MAP_FAILED) return;
+        dev->ring = hdr;
+        dev->ring_len = len;
+        dev->slots = (const void *) ((const char *) hdr + hdr->data_offset);
+        if (info_len)
+                dev->infos = (const void *) ((const char *) hdr + info_offset);
+        dev->shared = shared;
+        if (shared)
+        {
+                /* like the driver's own cursors, start at the next capture */
+                dev->next = Device_NewestSeq(dev) + 1;
+                dev->missed = 0;
+        }
+        return;
+}
+
+static int
+Device_Open(void *priv)
+{
+        struct device_source *dev = priv;
+        const char *name = dev->name ? dev->name : STORMTRACKER_DEVICE_NAME;
+        int lfd, writable = 1;
         
-        if (fd != -1) return 0;
+        if (dev->fd != -1) return 0;
         
-        lfd = open (STORMTRACKER_DEVICE_NAME, O_RDONLY);
+        /* up to ABI 5 the ring's tail is written through the mapping */
+        lfd = open (name, O_RDWR);
+        if (lfd == -1)
+        {
+                writable = 0;
+                lfd = open (name, O_RDONLY);
+        }
         
         if (lfd != -1)
         {
-                fd = lfd;
+                dev->fd = lfd;
+                dev->sequence = 0;
+                if (ioctl (lfd, BOLTEK_IOCTL_GET_VERSION, &dev->abi_version) == -1)
+                        dev->abi_version = 1;
+                Device_MapRing(dev, writable);
                 return 1;
         }
         return 0;
 }
 
+static void
+Device_Close(void *priv)
+{
+        struct device_source *dev = priv;
+
+        if (dev->ring)
+                munmap (dev->ring, dev->ring_len);
+        dev->ring = NULL;
+        dev->slots = NULL;
+        dev->infos = NULL;
+        dev->shared = 0;
+        dev->peeked = NULL;
+        close (dev->fd);
+        dev->fd = -1;
+        return;
+}
+
+// the capture at our cursor in a shared ring. The driver never waits
+// for us, so when we fell behind skip to the oldest capture it won't
+// be refilling next, counting the ones lost
+static const StormProcess_tPACKEDDATA *
+Device_SharedPeek(struct device_source *dev)
+{
+        __u32 entries = dev->ring->entries, slot;
+        unsigned long long newest, oldest;
+
+        newest = Device_NewestSeq(dev);
+        if (dev->next > newest) return NULL;
+
+        oldest = newest > entries - 2 ? newest - (entries - 2) : 1;
+        if (dev->next < oldest)
+        {
+                dev->missed += oldest - dev->next;
+                dev->next = oldest;
+        }
+        slot = (dev->next - 1) % entries;
+        if (__atomic_load_n (&dev->infos[slot].seq, __ATOMIC_ACQUIRE) != dev->next)
+                return NULL;    /* refilled under us, the next call skips it */
+        return &dev->slots[slot];
+}
+
+// the capture at the peeked slot is still the one we peeked
+static int
+Device_SharedValid(struct device_source *dev, const StormProcess_tPACKEDDATA *slot)
+{
+        __atomic_thread_fence (__ATOMIC_ACQUIRE);
+        return dev->infos[slot - dev->slots].seq == dev->next;
+}
+
+// oldest capture in the mapped ring, NULL if it is empty
+static const StormProcess_tPACKEDDATA *
+Device_RingPeek(struct device_source *dev)
+{
+        __u32 tail;
+
+        if (dev->shared) return Device_SharedPeek(dev);
+
+        tail = dev->ring->tail;
+        if (__atomic_load_n (&dev->ring->head, __ATOMIC_ACQUIRE) == tail)
+                return NULL;
+        return &dev->slots[tail];
+}
+
+static void
+Device_Release(void *priv)
+{
+        struct device_source *dev = priv;
+
+        free (dev->name);
+        dev->name = NULL;
+        free (dev->copy);
+        dev->copy = NULL;
+        return;
+}
+
+static void
+Device_Restart(void *priv)
+{
+        struct device_source *dev = priv;
+
+        /* newer drivers re-arm the board by themselves */
+        if (dev->fd == -1 || dev->abi_version >= BOLTEK_ABI_RING) return;
+        ioctl (dev->fd, BOLTEK_IOCTL_RESTART);
+        return;
+}
+
+static void
+Device_ForceTrigger(void *priv)
+{
+        struct device_source *dev = priv;
+
+        if (dev->fd == -1) return;
+        ioctl (dev->fd, BOLTEK_IOCTL_FORCE_TRIGGER);
+        return;
+}
+
+static int
+Device_StrikeReady(void *priv)
+{
+        struct device_source *dev = priv;
+        __u8 datachar;
+        
+        if (dev->fd == -1) return 0;
+        if (dev->ring) return Device_RingPeek(dev) != NULL;
+        ioctl (dev->fd, BOLTEK_IOCTL_STRIKE_READY, &datachar);
+        return (int) datachar;
+}
+
+// refused with EBUSY for a reader that doesn't own the card's squelch
+static int
+Device_SetSquelch(void *priv, char trig_level)
+{
+        struct device_source *dev = priv;
+        __u8 datachar;
+
+        if (dev->fd == -1) return 0;
+        datachar = trig_level;
+        return ioctl (dev->fd, BOLTEK_IOCTL_SET_SQUELCH, &datachar) != -1;
+}
+
+// the oldest capture in place when the ring is mapped, otherwise a copy
+static const StormProcess_tPACKEDDATA *
+Device_PeekData(void *priv)
+{
+        struct device_source *dev = priv;
+
+        if (dev->fd == -1) return NULL;
+        if (dev->ring) return Device_RingPeek(dev);
+
+        if (dev->peeked) return dev->peeked;
+        if (dev->copy == NULL && (dev->copy = malloc (sizeof(*dev->copy))) == NULL)
+                return NULL;
+        if (dev->abi_version < BOLTEK_ABI_RING && !Device_StrikeReady(dev))
+                return NULL;
+        if (ioctl (dev->fd, BOLTEK_IOCTL_GET_DATA, dev->copy) != 0)
+                return NULL;
+        dev->peeked = dev->copy;
+        return dev->peeked;
+}
+
+static void
+Device_ReleaseData(void *priv)
+{
+        struct device_source *dev = priv;
+
+        if (dev->fd == -1) return;
+        if (dev->shared)
+        {
+                /* nothing to hand back, just move our cursor on */
+                if (dev->next <= Device_NewestSeq(dev))
+                {
+                        dev->missed = 0;
+                        dev->next++;
+                }
+                return;
+        }
+        if (dev->ring)
+        {
+                /* hand the slot back, the driver may refill it right away */
+                if (Device_RingPeek(dev))
+                        __atomic_store_n (&dev->ring->tail,
+                                          (dev->ring->tail + 1) % dev->ring->entries,
+                                          __ATOMIC_RELEASE);
+                return;
+        }
+        dev->peeked = NULL;
+        Device_Restart(dev);
+        return;
+}
+
+static int
+Device_GetData(void *priv, StormProcess_tPACKEDDATA *board_data)
+{
+        struct device_source *dev = priv;
+        const StormProcess_tPACKEDDATA *slot;
+
+        /* struct stormpci_packed_data aka StormProcess_tPACKEDDATA */
+        if (dev->fd == -1) return 0;
+
+        if (dev->ring)
+        {
+                do
+                {
+                        if ((slot = Device_RingPeek(dev)) == NULL) return 0;
+                        memcpy (board_data, slot, sizeof(*board_data));
+                }
+                while (dev->shared && !Device_SharedValid(dev, slot));
+                Device_ReleaseData(dev);
+                return 1;
+        }
+        return ioctl (dev->fd, BOLTEK_IOCTL_GET_DATA, board_data) == 0;
+}
+
+static int
+Device_GetCapture(void *priv, StormProcess_tPACKEDDATA *board_data, StormPCI_tCAPTUREINFO *info)
+{
+        struct device_source *dev = priv;
+        struct stormpci_capture capture;
+        const StormProcess_tPACKEDDATA *slot;
+
+        if (dev->fd == -1) return 0;
+
+        if (dev->ring && dev->infos)
+        {
+                do
+                {
+                        if ((slot = Device_RingPeek(dev)) == NULL) return 0;
+                        memcpy (board_data, slot, sizeof(*board_data));
+                        CaptureInfo_FromDriver(&dev->infos[slot - dev->slots], info);
+                }
+                while (dev->shared && !Device_SharedValid(dev, slot));
+                if (dev->shared) info->missed = dev->missed;
+                Device_ReleaseData(dev);
+                return 1;
+        }
+        if (dev->abi_version >= BOLTEK_ABI_CAPTURE_INFO)
+        {
+                if (ioctl (dev->fd, BOLTEK_IOCTL_GET_DATA_AND_RESTART, &capture) != 0)
+                        return 0;
+                memcpy (board_data, &capture.data, sizeof(*board_data));
+                CaptureInfo_FromDriver(&capture.info, info);
+                return 1;
+        }
+
+        /* older drivers: the separate calls, numbered here */
+        if (dev->abi_version < BOLTEK_ABI_RING && !Device_StrikeReady(dev))
+                return 0;
+        if (!Device_GetData(dev, board_data)) return 0;
+        Device_Restart(dev);
+        CaptureInfo_Synthesize(&dev->sequence, info);
+        return 1;
+}
+
+static int
+Device_WaitForStrike(void *priv, int timeout_ms)
+{
+        struct device_source *dev = priv;
+        struct pollfd pfd;
+        int rv;
+
+        if (dev->fd == -1) return 0;
+        if (dev->ring && Device_RingPeek(dev)) return 1;
+
+        /* older drivers report every fd as readable, so poll them by hand */
+        if (dev->abi_version < BOLTEK_ABI_POLL)
+                return StormPCI_PollForStrike(&device_backend, priv, timeout_ms);
+
+        /* the driver's cursor for us only moves on read(), so tell it
+           where ours is or poll() stays readable after the first capture */
+        if (dev->shared && ioctl (dev->fd, BOLTEK_IOCTL_SET_CURSOR, &dev->next) == -1)
+                return StormPCI_PollForStrike(&device_backend, priv, timeout_ms);
+
+        pfd.fd = dev->fd;
+        pfd.events = POLLIN;
+        do
+                rv = poll (&pfd, 1, timeout_ms);
+        while (rv == -1 && errno == EINTR);
+        return rv > 0 && (pfd.revents & POLLIN);
+}
+
+static const StormPCI_tBACKEND device_backend =
+{
+        "device",
+        Device_Open,
+        Device_Close,
+        Device_Release,
+        Device_Restart,
+        Device_ForceTrigger,
+        Device_StrikeReady,
+        Device_SetSquelch,
+        Device_GetData,
+        Device_WaitForStrike,
+        Device_PeekData,
+        Device_ReleaseData,
+        Device_GetCapture,
+};
+
+
+//==================================================================
+// StormPCI contexts own one capture source each. The context-less
+// StormPCI_* calls use a static default context, so existing
+// applications are unchanged. Each context may be used by one thread
+// at a time.
+//
+static StormPCI_Context default_pci_context =
+{
+        &device_backend,
+        &default_pci_context.device,
+        0,
+        { NULL, -1, 0 },
+};
+
+StormPCI_Context* StormPCI_DefaultContext(void)
+{
+        return &default_pci_context;
+}
+
+StormPCI_Context* StormPCI_CreateContext(void)
+{
+        StormPCI_Context *ctx;
+
+        ctx = calloc (1, sizeof(*ctx));
+        if (ctx == NULL) return NULL;
+        ctx->device.fd = -1;
+        ctx->backend = &device_backend;
+        ctx->backend_priv = &ctx->device;
+        return ctx;
+}
+
+void StormPCI_DestroyContext(StormPCI_Context *ctx)
+{
+        if (ctx == NULL) return;
+        StormPCI_ClosePciCardCtx(ctx);
+        if (ctx->backend->release)
+                ctx->backend->release(ctx->backend_priv);
+        free (ctx->copy);
+        ctx->copy = NULL;
+        if (ctx != &default_pci_context)
+                free (ctx);
+        return;
+}
+
+// select the source the context reads from - non-zero on success
+int StormPCI_UseBackendCtx(StormPCI_Context *ctx, const StormPCI_tBACKEND *backend, void *priv)
+{
+        if (ctx->opened || backend == NULL) return 0;
+
+        if (ctx->backend->release)
+                ctx->backend->release(ctx->backend_priv);
+        ctx->backend = backend;
+        ctx->backend_priv = priv;
+        return 1;
+}
+
+// read from the card at device_name (NULL for STORMTRACKER_DEVICE_NAME)
+int StormPCI_UseDeviceCtx(StormPCI_Context *ctx, const char *device_name)
+{
+        char *name = NULL;
+
+        if (ctx->opened) return 0;
+        if (device_name && (name = strdup (device_name)) == NULL) return 0;
+        if (!StormPCI_UseBackendCtx(ctx, &device_backend, &ctx->device))
+        {
+                free (name);
+                return 0;
+        }
+        ctx->device.name = name;
+        return 1;
+}
+
+// read from card N - non-zero on success
+int StormPCI_UseCardCtx(StormPCI_Context *ctx, int card)
+{
+        char name[32];
+
+        if (card < 0 || card >= STORMTRACKER_MAX_CARDS) return 0;
+        snprintf (name, sizeof(name), STORMTRACKER_CARD_NAME, card);
+        return StormPCI_UseDeviceCtx(ctx, name);
+}
+
+int StormPCI_OpenPciCardCtx(StormPCI_Context *ctx)
+{
+        if (ctx->opened) return 0;
+
+        ctx->sequence = 0;
+        ctx->opened = ctx->backend->open(ctx->backend_priv);
+        return ctx->opened;
+}
+
+void StormPCI_ClosePciCardCtx(StormPCI_Context *ctx)
+{
+        if (ctx->opened)
+                ctx->backend->close(ctx->backend_priv);
+        ctx->opened = 0;
+        ctx->peeked = NULL;
+        return;
+}
+
+void StormPCI_RestartBoardCtx(StormPCI_Context *ctx)
+{
+        if (!ctx->opened) return;
+        ctx->backend->restart(ctx->backend_priv);
+        return;
+}
+
+void StormPCI_ForceTriggerCtx(StormPCI_Context *ctx)
+{
+        if (!ctx->opened) return;
+        ctx->backend->force_trigger(ctx->backend_priv);
+        return;
+}
+
+int  StormPCI_StrikeReadyCtx(StormPCI_Context *ctx)
+{
+        if (!ctx->opened) return 0;
+        return ctx->backend->strike_ready(ctx->backend_priv);
+}
+
+int  StormPCI_SetSquelchCtx(StormPCI_Context *ctx, char trig_level)
+{
+        if (!ctx->opened) return 0;
+        return ctx->backend->set_squelch(ctx->backend_priv, trig_level);
+}
+
+void StormPCI_GetBoardDataCtx(StormPCI_Context *ctx, StormProcess_tPACKEDDATA *board_data)
+{
+        if (!ctx->opened) return;
+        ctx->backend->get_data(ctx->backend_priv, board_data);
+        return;
+}
+
+// for backends that can't sleep until a strike arrives: check every ms
+int StormPCI_PollForStrike(const StormPCI_tBACKEND *backend, void *priv, int timeout_ms)
+{
+        struct timespec tick = { 0, 1000000 };
+        int waited;
+
+        for (waited = 0; timeout_ms < 0 || waited < timeout_ms; waited++)
+        {
+                if (backend->strike_ready(priv)) return 1;
+                nanosleep (&tick, NULL);
+        }
+        return backend->strike_ready(priv);
+}
+
+int  StormPCI_WaitForStrikeCtx(StormPCI_Context *ctx, int timeout_ms)
+{
+        if (!ctx->opened) return 0;
+        if (ctx->backend->wait_for_strike)
+                return ctx->backend->wait_for_strike(ctx->backend_priv, timeout_ms);
+        return StormPCI_PollForStrike(ctx->backend, ctx->backend_priv, timeout_ms);
+}
+
+int  StormPCI_GetCaptureCtx(StormPCI_Context *ctx, StormProcess_tPACKEDDATA *board_data, StormPCI_tCAPTUREINFO *info)
+{
+        StormPCI_tCAPTUREINFO unused;
+
+        if (!ctx->opened) return 0;
+        if (info == NULL) info = &unused;
+        if (ctx->backend->get_capture)
+                return ctx->backend->get_capture(ctx->backend_priv, board_data, info);
+
+        if (!ctx->backend->strike_ready(ctx->backend_priv)) return 0;
+        if (!ctx->backend->get_data(ctx->backend_priv, board_data)) return 0;
+        ctx->backend->restart(ctx->backend_priv);
+        CaptureInfo_Synthesize(&ctx->sequence, info);
+        return 1;
+}
+
+// backends without peek_data are copied into the context
+const StormProcess_tPACKEDDATA* StormPCI_PeekCaptureCtx(StormPCI_Context *ctx)
+{
+        if (!ctx->opened) return NULL;
+        if (ctx->backend->peek_data)
+                return ctx->backend->peek_data(ctx->backend_priv);
+
+        if (ctx->peeked) return ctx->peeked;
+        if (!ctx->backend->strike_ready(ctx->backend_priv)) return NULL;
+        if (ctx->copy == NULL && (ctx->copy = malloc (sizeof(*ctx->copy))) == NULL)
+                return NULL;
+        if (!ctx->backend->get_data(ctx->backend_priv, ctx->copy)) return NULL;
+        ctx->peeked = ctx->copy;
+        return ctx->peeked;
+}
+
+void StormPCI_ReleaseCaptureCtx(StormPCI_Context *ctx)
+{
+        if (!ctx->opened) return;
+        if (ctx->backend->release_data)
+        {
+                ctx->backend->release_data(ctx->backend_priv);
+                return;
+        }
+        ctx->peeked = NULL;
+        ctx->backend->restart(ctx->backend_priv);
+        return;
+}
+
+int StormPCI_ExhaustedCtx(StormPCI_Context *ctx)
+{
+        if (!ctx->opened || ctx->backend->exhausted == NULL) return 0;
+        return ctx->backend->exhausted(ctx->backend_priv);
+}
+
+
+// select the source the StormPCI_* calls read from - non-zero on success
+int StormPCI_UseBackend(const StormPCI_tBACKEND *backend, void *priv)
+{
+        return StormPCI_UseBackendCtx(&default_pci_context, backend, priv);
+}
+
+// read from the card at device_name (NULL for STORMTRACKER_DEVICE_NAME)
+int StormPCI_UseDevice(const char *device_name)
+{
+        return StormPCI_UseDeviceCtx(&default_pci_context, device_name);
+}
+
+int StormPCI_UseCard(int card)
+{
+        return StormPCI_UseCardCtx(&default_pci_context, card);
+}
+
+// the cards with a device node, each one can be given its own context
+// with StormPCI_UseCardCtx() - the number found
+int StormPCI_EnumerateCards(int cards[], int max)
+{
+        char name[32];
+        int card, found = 0;
+
+        for (card = 0; card < STORMTRACKER_MAX_CARDS && found < max; card++)
+        {
+                snprintf (name, sizeof(name), STORMTRACKER_CARD_NAME, card);
+                if (access (name, F_OK) == 0)
+                        cards[found++] = card;
+        }
+        return found;
+}
+
+// connect to the StormTracker card - non-zero on success
+int StormPCI_OpenPciCard()
+{
+        return StormPCI_OpenPciCardCtx(&default_pci_context);
+}
+
 
 // clean up, all done
 void StormPCI_ClosePciCard()
 {
-        close (fd);
-        fd = -1;
+        StormPCI_ClosePciCardCtx(&default_pci_context);
         return;
 }
 
 // after reading the data, wait for the next strike
 void StormPCI_RestartBoard()
 {
-        if (fd == -1) return;
-        ioctl (fd, BOLTEK_IOCTL_RESTART);
+        StormPCI_RestartBoardCtx(&default_pci_context);
         return;
 }
 
 // force StormTracker to give you a capture
 void StormPCI_ForceTrigger()
 {
-        if (fd == -1) return;
-        ioctl (fd, BOLTEK_IOCTL_FORCE_TRIGGER);
+        StormPCI_ForceTriggerCtx(&default_pci_context);
         return;
 }
 
@@ -76,112 +744,56 @@ void StormPCI_ForceTrigger()
 // non-zero if a strike is ready
 int  StormPCI_StrikeReady()
 {
-        __u8 datachar;
-        
-        if (fd == -1) return 0;
-        ioctl (fd, BOLTEK_IOCTL_STRIKE_READY, &datachar);
-        return (int) datachar;
+        return StormPCI_StrikeReadyCtx(&default_pci_context);
 }
 
 // 0-15, 0:most sensitive (preferred), 15: least sensitive
-void StormPCI_SetSquelch(char trig_level)
+int  StormPCI_SetSquelch(char trig_level)
 {
-        __u8 datachar;
+        return StormPCI_SetSquelchCtx(&default_pci_context, trig_level);
+}
 
-        if (fd == -1) return;
-        datachar = trig_level;
-        ioctl (fd, BOLTEK_IOCTL_SET_SQUELCH, &datachar);
+// retrieve the waiting capture
+void StormPCI_GetBoardData(StormProcess_tPACKEDDATA * board_data)
+{
+        StormPCI_GetBoardDataCtx(&default_pci_context, board_data);
         return;
 }
 
+// sleep until a strike is ready or timeout_ms passes (-1 waits forever)
+// non-zero if a strike is ready
+int  StormPCI_WaitForStrike(int timeout_ms)
+{
+        return StormPCI_WaitForStrikeCtx(&default_pci_context, timeout_ms);
+}
 
-//==================================================================
-static StormProcess_tTIMESTAMPINFO 
-ExtractGPSData(StormProcess_tPACKEDDATA *packeddata)
-{
-	StormProcess_tTIMESTAMPINFO tgps;
-	unsigned char gpsdata[200];		// gps sentence
-	unsigned char checksum = 0;
-	int cnt;
-
-	// Put timestamp data into gpsdata[] temporarily
-	for (cnt=0; cnt < 10; cnt++)
-	{
-		gpsdata[cnt] = ((packeddata->usWest[cnt] & 0xff00) >> 8);	// 9 bytes of timestamp data before gps data
-	}
-	
-	// Is the TS data valid?
-	for (cnt = 0; cnt <9; cnt++)
-	{	checksum += gpsdata[cnt];	}
-	tgps.TS_valid = ((checksum&0xff) == gpsdata[8]) ? true : false;
-
-	tgps.TS_10ms = gpsdata[0];
-	tgps.TS_time = gpsdata[1] + gpsdata[2]*256 + gpsdata[3]*65536 + gpsdata[4]*16777216;
-	tgps.TS_Osc  = gpsdata[5] + gpsdata[6]*256 + gpsdata[7]*65536 + gpsdata[8]*16777216;
-
-	// extract gps data from capture
-	for (cnt=0; cnt < 157; cnt++)
-	{
-		gpsdata[cnt] = ((packeddata->usWest[cnt+10] & 0xff00) >> 8);	// 9 bytes of timestamp data before gps data
-	}
-
-	// Is the GPS data valid?
-	checksum = 0;
-	for (cnt = 2; cnt <150; cnt++)
-	{	checksum ^= gpsdata[cnt];	}
-	tgps.gps_data_valid = (checksum == gpsdata[151]) ? true : false;
-
-	// Date/Time
-	tgps.month = gpsdata[4]; 
-	tgps.day = gpsdata[5];
-	tgps.year = gpsdata[6] * 256 + gpsdata[7];
-	tgps.hours = gpsdata[8];
-	tgps.minutes = gpsdata[9];
-	tgps.seconds = gpsdata[10];
-
-	// Latitude/Longitude
-	tgps.latitude_mas = gpsdata[18] + (gpsdata[17]*256) + (gpsdata[16]*65536) + (gpsdata[15]*16777216);
-	tgps.longitude_mas = gpsdata[22] + (gpsdata[21]*256) + (gpsdata[20]*65536) + (gpsdata[19]*16777216);
-	tgps.height_cm = gpsdata[26] + (gpsdata[25]*256) + (gpsdata[24]*65536) + (gpsdata[23]*16777216);
-
-	if (tgps.latitude_mas<0) {
-	   tgps.latitude_mas=abs(tgps.latitude_mas);
-	   tgps.latitude_ns='S';
-	}
-	else
-		tgps.latitude_ns='N';
-        
-	if (tgps.longitude_mas<0) {
-                tgps.longitude_mas=abs(tgps.longitude_mas);
-                tgps.longitude_ew='W';
-	}
-	else
-		tgps.longitude_ew='E';
-        
-	// Satellite Status
-	tgps.dop = gpsdata[54] + (gpsdata[53] * 256);
-	tgps.satellites_visible = gpsdata[55];
-	tgps.satellites_tracked = gpsdata[56];
-        
-	for (cnt=0; cnt < 12; cnt++)
-	{
-		tgps.satellite[cnt].SVID = gpsdata[57+(cnt*6)];
-		tgps.satellite[cnt].mode = gpsdata[58+(cnt*6)];
-		tgps.satellite[cnt].signal_strength = gpsdata[59+(cnt*6)];
-		tgps.satellite[cnt].channel_status = gpsdata[62+(cnt*6)] + (gpsdata[61+(cnt*6)]*256);
-	}
-        
-	tgps.receiver_status = gpsdata[130] + (gpsdata[129]*256);
-	tgps.oscillator_temperature = (gpsdata[140] + (gpsdata[139]*256))>>1; // convert half degrees to degrees C
-	tgps.serial_number = gpsdata[156] + (gpsdata[155]*256);
-        
-	return tgps;
+// retrieve the waiting capture and wait for the next one - non-zero if
+// a capture was ready
+int  StormPCI_GetCapture(StormProcess_tPACKEDDATA *board_data, StormPCI_tCAPTUREINFO *info)
+{
+        return StormPCI_GetCaptureCtx(&default_pci_context, board_data, info);
 }
 
+// the waiting capture without copying it, NULL if none is ready
+const StormProcess_tPACKEDDATA* StormPCI_PeekCapture(void)
+{
+        return StormPCI_PeekCaptureCtx(&default_pci_context);
+}
 
+// done with the capture from StormPCI_PeekCapture(), wait for the next
+void StormPCI_ReleaseCapture(void)
+{
+        StormPCI_ReleaseCaptureCtx(&default_pci_context);
+        return;
+}
+
+// the replay has handed out its last capture
+int StormPCI_Exhausted(void)
+{
+        return StormPCI_ExhaustedCtx(&default_pci_context);
+}
 
 
-#define MAXBUFVAL 1020    /*  1020 = 255 * 4 byte filter  */
 #define CLIPEXTRAPVAL 10	/*  how much bigger should the signal be, if we clipped  */
 #define E_FIELD_OFFSET 10    /*  E-Field leads H-Field  */
 #define FREQUENCYCHECK 45    /*  Min and Max must be this far apart to be Valid  */
@@ -191,32 +803,157 @@ ExtractGPSData(StormProcess_tPACKEDDATA *packeddata)
 #define SCREENSCALINGCONSTANT 23.0    /*  adjusts how far out from center strikes fall */
 #define R_SCREEN_LIMIT 0.09235    /*  0.121; Capture.Process limits real X/Y to this  */
 /*  Process(): Miles = StrikeDistance*MilesConstant, for Close Storm Alarm  */
-#define MILESCONSTANT (R_SCREEN_LIMIT/300)    /*  decrease 3?? to decrease miles  */
+#define MILESSCALE 300    /*  decrease 3?? to decrease miles  */
+#define MILESCONSTANT (R_SCREEN_LIMIT/MILESSCALE)
 #define SUCKMULTIPLY R_SCREEN_LIMIT / (R_SCREEN_LIMIT - SUCKSUBTRACT)
 #define AVERAGEDURATION 400    /*  replace average strike dist after this many demis  */
 #define DELTAPLUSLIMITMVAL 55    /*  Limit far strikes pull out = (m*strikerate) + b */
 #define DELTAMINUSFILTERVAL 0.68 // Reduce impact of close in strikes 0-1.0x
 #define DELTAPLUSLIMITBVAL 400    /*  Limit far strikes pull out when low strikerate  */
+#define AVERAGEBINS 360    /*  one degree bearings  */
+#define AVERAGESPREAD 3    /*  each strike smooths 3 bearings either side  */
 
+#define DEFAULT_PARAMS { E_FIELD_OFFSET, FREQUENCYCHECK, SUCKIN, R_SCREEN_LIMIT, MILESSCALE, \
+                        SCREENSCALINGCONSTANT, AVERAGEDURATION, DELTAPLUSLIMITMVAL, \
+                        DELTAPLUSLIMITBVAL, DELTAMINUSFILTERVAL, AVERAGEBINS, AVERAGESPREAD }
 
+/*  the same for STORMPROCESS_MATH_FIXED, converted by the compiler, see Fixed_Params()  */
+#define DEFAULT_FIXED_PARAMS { FIX_DISTANCE(SUCKSUBTRACT), FIX_RATIO(SUCKMULTIPLY), \
+                        FIX_DISTANCE(R_SCREEN_LIMIT / (DELTAPLUSLIMITMVAL * DELTAPLUSLIMITBVAL)), \
+                        FIX_RATIO(DELTAMINUSFILTERVAL), FIX_MILES(1 / MILESCONSTANT) }
 
-void
-StormProcess_UnpackCaptureData(StormProcess_tPACKEDDATA *packed_data, StormProcess_tBOARDDATA* board_data)
+
+//==================================================================
+// StormProcess contexts own the tuning parameters and the bearing
+// averages. The context-less StormProcess_* calls use a static default
+// context. Each context may be used by one thread at a time.
+//
+static StormProcess_Context default_process_context = { DEFAULT_PARAMS, DEFAULT_FIXED_PARAMS };
+
+void StormProcess_DefaultParams(StormProcess_tPARAMS *params)
 {
-        int cnt;
-        
-        for (cnt = 0; cnt < BOLTEK_BUFFERSIZE; cnt++)
+        static const StormProcess_tPARAMS defaults = DEFAULT_PARAMS;
+
+        *params = defaults;
+        return;
+}
+
+StormProcess_Context* StormProcess_DefaultContext(void)
+{
+        return &default_process_context;
+}
+
+StormProcess_Context* StormProcess_CreateContext(const StormProcess_tPARAMS *params)
+{
+        static const struct fixed_params fixed_defaults = DEFAULT_FIXED_PARAMS;
+        StormProcess_Context *ctx;
+
+        ctx = calloc (1, sizeof(*ctx));
+        if (ctx == NULL) return NULL;
+        StormProcess_DefaultParams(&ctx->params);
+        ctx->fixed = fixed_defaults;
+        if (params && !StormProcess_SetParams(ctx, params))
         {
-                board_data->NorthBuf[cnt] = packed_data->usNorth[cnt] & 0xff;
-                board_data->EastBuf[cnt] = packed_data->usWest[cnt] & 0xff;
-                board_data->EFieldBuf[cnt] = (packed_data->usNorth[cnt] & 0x0100) == 0x100;
+                free (ctx);
+                return NULL;
         }
+        return ctx;
+}
+
+void StormProcess_DestroyContext(StormProcess_Context *ctx)
+{
+        if (ctx == NULL) return;
+        Batch_Destroy(ctx);
+        if (ctx != &default_process_context)
+                free (ctx);
+        return;
+}
+
+// non-zero on success, the context is unchanged if params are out of range
+int StormProcess_SetParams(StormProcess_Context *ctx, const StormProcess_tPARAMS *params)
+{
+        struct fixed_params fixed;
+        int fits;
+
+        if (params->e_field_offset < 0 || params->e_field_offset >= BOLTEK_BUFFERSIZE ||
+            params->frequency_check < 0 ||
+            params->suckin < 0.0 || params->suckin >= 1.0 ||
+            params->r_screen_limit <= 0.0 || params->miles_scale <= 0.0 ||
+            params->average_duration < 0 ||
+            params->delta_plus_limit_m <= 0.0 || params->delta_plus_limit_b <= 0.0 ||
+            params->delta_minus_filter < 0.0 || params->delta_minus_filter > 1.0 ||
+            params->average_bins < 1 || params->average_bins > AVERAGE_MAX_BINS ||
+            params->average_spread < 0 || params->average_spread > AVERAGE_MAX_SPREAD ||
+            2 * params->average_spread >= params->average_bins)
+                return 0;
+        fits = Fixed_Params(params, &fixed);
+        if (!fits && ctx->math == STORMPROCESS_MATH_FIXED)
+                return 0;
+
+        /*  averages of another resolution mean nothing now  */
+        if (params->average_bins != ctx->params.average_bins)
+                StormProcess_ResetAverages(ctx);
+
+        ctx->params = *params;
+        if (fits) ctx->fixed = fixed;
+        return 1;
+}
+
+void StormProcess_GetParams(StormProcess_Context *ctx, StormProcess_tPARAMS *params)
+{
+        *params = ctx->params;
+        return;
+}
+
+// STORMPROCESS_MATH_* - non-zero on success
+int StormProcess_SetMath(StormProcess_Context *ctx, int math)
+{
+        if (math != STORMPROCESS_MATH_EXACT && math != STORMPROCESS_MATH_FAST &&
+            math != STORMPROCESS_MATH_FIXED)
+                return 0;
+        if (math == STORMPROCESS_MATH_FIXED && !Fixed_Params(&ctx->params, &ctx->fixed))
+                return 0;
+
+        /*  the fixed point averages are kept apart  */
+        if ((math == STORMPROCESS_MATH_FIXED) != (ctx->math == STORMPROCESS_MATH_FIXED))
+                StormProcess_ResetAverages(ctx);
+        ctx->math = math;
+        return 1;
+}
+
+// forget all bearing averages, as if no strike had been seen yet
+void StormProcess_ResetAverages(StormProcess_Context *ctx)
+{
+        memset (ctx->Average, 0, sizeof(ctx->Average));
+        memset (ctx->AverageFixed, 0, sizeof(ctx->AverageFixed));
+        memset (ctx->AverageTime, 0, sizeof(ctx->AverageTime));
+        return;
+}
+
+void StormProcess_GetRejects(StormProcess_Context *ctx, StormProcess_tREJECTS *rejects)
+{
+        *rejects = ctx->rejects;
+        return;
+}
+
+void StormProcess_ResetRejects(StormProcess_Context *ctx)
+{
+        memset (&ctx->rejects, 0, sizeof(ctx->rejects));
+        return;
+}
+
+
+
+void
+StormProcess_UnpackCaptureData(const StormProcess_tPACKEDDATA *packed_data, StormProcess_tBOARDDATA* board_data)
+{
+        Unpack_Samples(packed_data, board_data);
         // Fill the tTIMESTAMPINFO lts2_data fields
         board_data->lts2_data = ExtractGPSData(packed_data);
         return;
 }
 
-static void 
+void 
 Capture_Filter(StormProcess_tBOARDDATA* capture)
 {
         int      X;
@@ -242,153 +979,156 @@ Capture_Filter(StormProcess_tBOARDDATA* capture)
         return;
 }
 
-static void 
-Capture_Find_Peaks(StormProcess_tBOARDDATA* capture)
-/*
-  Original Find Peaks algorithm. No clipping here
-*/
+// one channel's extremes, and how many samples sat at either end of the
+// filter's range. Ties keep the first position
+void
+Peaks_Scan_C(const int *buf, struct peak_scan *scan)
 {
-        int      NorthClipValue, EastClipValue, Count, NorthClipPositive, NorthClipNegative,
-                EastClipPositive, EastClipNegative, NorthPkMax, NorthPkMin, EastPkMax, EastPkMin;
-        
-        NorthPkMax = 0;
-        EastPkMax = 0;
-        NorthPkMin = 32000;
-        EastPkMin = 32000;
-        NorthClipValue = 0; 
-        EastClipValue = 0;
-        NorthClipPositive = 0;   /*  zero clip counter  */
-        NorthClipNegative = 0;   /*  zero clip counter  */
-        EastClipPositive = 0;   /*  zero clip counter  */
-        EastClipNegative = 0;   /*  zero clip counter  */ 
+        int Count;
+
+        scan->max = 0;
+        scan->min = 32000;
+        /*  a flat channel never beats PkMax, so give the positions a start  */
+        scan->max_pos = scan->min_pos = 3;
+        scan->clip_pos = scan->clip_neg = 0;   /*  zero clip counters  */
         /*  Don't start at position zero since we often have bad sample(s?) there  */ 
         for (Count = 3; Count < BOLTEK_BUFFERSIZE; Count++) {
-                if (capture->NorthBuf[Count] > NorthPkMax) { 
-                        NorthPkMax = capture->NorthBuf[Count];
-                        capture->NorthMaxPos = Count;
+                if (buf[Count] > scan->max) { 
+                        scan->max = buf[Count];
+                        scan->max_pos = Count;
                 } 
-                if (capture->NorthBuf[Count] < NorthPkMin) { 
-                        NorthPkMin = capture->NorthBuf[Count];
-                        capture->NorthMinPos = Count;
-                } 
-                if (capture->EastBuf[Count] > EastPkMax) {
-                        EastPkMax = capture->EastBuf[Count];
-                        capture->EastMaxPos = Count;
-                }
-                if (capture->EastBuf[Count] < EastPkMin) {
-                        EastPkMin = capture->EastBuf[Count];
-                        capture->EastMinPos = Count; 
+                if (buf[Count] < scan->min) { 
+                        scan->min = buf[Count];
+                        scan->min_pos = Count;
                 } 
 		/*  NOW CHECK FOR CLIPPING SIGNAL: IF WE ARE STUCK AT MaxBufVal THEN  */
 		/*  WE ARE CLIPPING SO EXTRAPOLATE UPWARDS BASED ON A STRAIGHT LINE  */
                 /*  CONSTANT: ClipExtrapVal IS THE SLOPE OF THE LINE  */ 
-                
-                /*  Check for North Clipping +'ve  */ 
-                if (capture->NorthBuf[Count] == MAXBUFVAL) {
-                        NorthClipValue = NorthClipValue + CLIPEXTRAPVAL;
-                        NorthClipPositive++;   /*  counter for peak location  */
-                }
-		/*  Check for North Clipping -'ve  */
-                if (capture->NorthBuf[Count] == 0) {
-                        NorthClipValue = NorthClipValue + CLIPEXTRAPVAL;
-                        NorthClipNegative++;   /*  counter for peak location  */
-                }
-		/*  Check for East Clipping +'ve  */
-                if (capture->EastBuf[Count] == MAXBUFVAL) {
-                        EastClipValue = EastClipValue + CLIPEXTRAPVAL;
-                        EastClipPositive++;   /*  counter for peak location  */
-                }
-		/*  Check for East Clipping -'ve  */
-                if (capture->EastBuf[Count] == 0) {
-                        EastClipValue = EastClipValue + CLIPEXTRAPVAL;
-                        EastClipNegative++;   /*  counter for peak location  */
-                }
+                if (buf[Count] == MAXBUFVAL)
+                        scan->clip_pos++;   /*  counter for peak location  */
+                if (buf[Count] == 0)
+                        scan->clip_neg++;   /*  counter for peak location  */
         }
+        return;
+}
+
+// the clip adjusted positions of both channels' peaks, the positions
+// the second half of the peak finding measures the other channel at
+void
+Peaks_Positions(const struct peak_scan *north, const struct peak_scan *east, struct capture_peaks *peaks)
+{
         /*  If we clipped then move the increase the peak location so that
             peak is the middle of the clipped off peak, not the start  */
-        capture->NorthMaxPos = capture->NorthMaxPos + (NorthClipPositive / 2);
-        capture->NorthMinPos = capture->NorthMinPos + (NorthClipNegative / 2);
-        capture->EastMaxPos = capture->EastMaxPos + (EastClipPositive / 2);
-        capture->EastMinPos = capture->EastMinPos + (EastClipNegative / 2);
-        
-        capture->North_Pk = NorthPkMax - NorthPkMin;
-        capture->East_Pk = EastPkMax - EastPkMin; 
-        
+        peaks->NorthMaxPos = north->max_pos + (north->clip_pos / 2);
+        peaks->NorthMinPos = north->min_pos + (north->clip_neg / 2);
+        peaks->EastMaxPos = east->max_pos + (east->clip_pos / 2);
+        peaks->EastMinPos = east->min_pos + (east->clip_neg / 2);
+        return;
+}
+
+// finish the peaks from Peaks_Positions. other_pk is the other channel
+// measured at the winning channel's positions: EastBuf at the north
+// positions if north_wins, NorthBuf at the east positions otherwise
+void
+Peaks_Resolve(const struct peak_scan *north, const struct peak_scan *east, int other_pk,
+              struct capture_peaks *peaks)
+{
+        int NorthMaxPos = peaks->NorthMaxPos, NorthMinPos = peaks->NorthMinPos;
+        int EastMaxPos = peaks->EastMaxPos, EastMinPos = peaks->EastMinPos;
+
         /*  Now, the largest signal determines where we measure signals  */
-        if (capture->North_Pk > capture->East_Pk) { 
+        if (Peaks_NorthWins(north, east)) { 
 		/*  NORTH WINS  */
-                capture->EastMinPos = capture->NorthMinPos; 
-                capture->EastMaxPos = capture->NorthMaxPos; 
+                peaks->EastMinPos = NorthMinPos; 
+                peaks->EastMaxPos = NorthMaxPos; 
+                peaks->North_Pk = north->max - north->min;
                 
 		/* Remeasure East signal with new positions  */
-                capture->East_Pk = capture->EastBuf[capture->EastMaxPos] - capture->EastBuf[capture->EastMinPos];
-                if (capture->East_Pk < 0) { 
+                peaks->East_Pk = other_pk;
+                if (peaks->East_Pk < 0) { 
                         /*  We've got min and max reversed  */ 
-                        capture->EastMinPos = capture->NorthMaxPos;
-                        capture->EastMaxPos = capture->NorthMinPos;
-                        capture->East_Pk = -capture->East_Pk;
+                        peaks->EastMinPos = NorthMaxPos;
+                        peaks->EastMaxPos = NorthMinPos;
+                        peaks->East_Pk = -peaks->East_Pk;
                 } 
         }
         else {   /*  EAST WINS  */
-                capture->NorthMinPos = capture->EastMinPos; 
-                capture->NorthMaxPos = capture->EastMaxPos;
+                peaks->NorthMinPos = EastMinPos; 
+                peaks->NorthMaxPos = EastMaxPos;
+                peaks->East_Pk = east->max - east->min;
                 
                 /* Remeasure North signal with new positions  */
-                capture->North_Pk = capture->NorthBuf[capture->NorthMaxPos] - capture->NorthBuf[capture->NorthMinPos];
-                if (capture->North_Pk < 0) { 
+                peaks->North_Pk = other_pk;
+                if (peaks->North_Pk < 0) { 
                         /*  We've got min and max reversed  */ 
-                        capture->NorthMinPos = capture->EastMaxPos;
-                        capture->NorthMaxPos = capture->EastMinPos;
-                        capture->North_Pk = -capture->North_Pk;
+                        peaks->NorthMinPos = EastMaxPos;
+                        peaks->NorthMaxPos = EastMinPos;
+                        peaks->North_Pk = -peaks->North_Pk;
 		}
         }
         /*  Add any extra from clipping  */
-        capture->North_Pk = capture->North_Pk + NorthClipValue;
-        capture->East_Pk = capture->East_Pk + EastClipValue;
+        peaks->North_Pk = peaks->North_Pk + (north->clip_pos + north->clip_neg) * CLIPEXTRAPVAL;
+        peaks->East_Pk = peaks->East_Pk + (east->clip_pos + east->clip_neg) * CLIPEXTRAPVAL;
         return;
 }
 
-
-static bool 
-Capture_Valid(StormProcess_tBOARDDATA* capture)
+void 
+Capture_Find_Peaks(StormProcess_tBOARDDATA* capture)
 /*
-  This fuunction must execute to the end since E_Field_Polarity
-  is figured out here.
+  Original Find Peaks algorithm. No clipping here
 */
 {
-        bool CapValid = true;
-        int NorthMinE_FCheck, NorthMaxE_FCheck, EastMinE_FCheck, EastMaxE_FCheck;
-        /*
-          Check E-Field Coherency
-          Invalid if E-Field is same polarity at min & max.
-          E_Field is not exactly in phase with H field, so Offset E Field position
-	*/
-        if (capture->NorthMinPos > E_FIELD_OFFSET)
-                NorthMinE_FCheck = capture->EFieldBuf[capture->NorthMinPos - E_FIELD_OFFSET];
-        else
-                NorthMinE_FCheck = capture->EFieldBuf[capture->NorthMinPos];
-
-        if (capture->NorthMaxPos > E_FIELD_OFFSET)
-                NorthMaxE_FCheck = capture->EFieldBuf[capture->NorthMaxPos - E_FIELD_OFFSET];
+        struct peak_scan north, east;
+        struct capture_peaks peaks;
+        int other_pk;
+
+        Peaks_Scan(capture->NorthBuf, capture->EastBuf, &north, &east);
+        Peaks_Positions(&north, &east, &peaks);
+        if (Peaks_NorthWins(&north, &east))
+                other_pk = capture->EastBuf[peaks.NorthMaxPos] - capture->EastBuf[peaks.NorthMinPos];
         else
-                NorthMaxE_FCheck = capture->EFieldBuf[capture->NorthMaxPos];
+                other_pk = capture->NorthBuf[peaks.EastMaxPos] - capture->NorthBuf[peaks.EastMinPos];
+        Peaks_Resolve(&north, &east, other_pk, &peaks);
+
+        capture->NorthMaxPos = peaks.NorthMaxPos;
+        capture->NorthMinPos = peaks.NorthMinPos;
+        capture->EastMaxPos = peaks.EastMaxPos;
+        capture->EastMinPos = peaks.EastMinPos;
+        capture->North_Pk = peaks.North_Pk;
+        capture->East_Pk = peaks.East_Pk;
+        return;
+}
 
-        if (capture->EastMinPos > E_FIELD_OFFSET)
-                EastMinE_FCheck = capture->EFieldBuf[capture->EastMinPos - E_FIELD_OFFSET];
-        else
-                EastMinE_FCheck = capture->EFieldBuf[capture->EastMinPos];
 
-        if (capture->EastMaxPos > E_FIELD_OFFSET)
-                EastMaxE_FCheck = capture->EFieldBuf[capture->EastMaxPos - E_FIELD_OFFSET];
-        else
-                EastMaxE_FCheck = capture->EFieldBuf[capture->EastMaxPos];
+// where the E-field is sampled for an H-field peak at pos
+int
+Valid_EFieldPos(const StormProcess_tPARAMS *params, int pos)
+{
+        /*  E_Field is not exactly in phase with H field, so Offset E Field position  */
+        return pos > params->e_field_offset ? pos - params->e_field_offset : pos;
+}
 
-        /*  If E Field doesn't change during capture then E Field not valid  */
-        if ((NorthMinE_FCheck == NorthMaxE_FCheck) && (EastMinE_FCheck == EastMaxE_FCheck))
-		CapValid = false;
+// the decision half of Capture_Valid, given the peaks and the E-field at
+// Valid_EFieldPos() of each of them. Sets the polarities in pol and
+// returns REJECT_NONE for a strike
+int
+Valid_Decide(const StormProcess_tPARAMS *params, const struct capture_peaks *peaks,
+             int NorthMinE_FCheck, int NorthMaxE_FCheck, int EastMinE_FCheck, int EastMaxE_FCheck,
+             struct capture_pol *pol)
+/*
+  This fuunction must execute to the end since E_Field_Polarity
+  is figured out here.
+*/
+{
+        int reject = REJECT_NONE;
 
         /*  IF MIN AND MAX ARE TOO CLOSE THEN THIS IS HIGH FREQ NOISE  */
-        if (abs(capture->NorthMaxPos - capture->NorthMinPos) < FREQUENCYCHECK) CapValid = false;
+        if (!Valid_Frequency(params, peaks))
+                reject = REJECT_FREQUENCY;
+
+        /*  If E Field doesn't change during capture then E Field not valid  */
+        else if ((NorthMinE_FCheck == NorthMaxE_FCheck) && (EastMinE_FCheck == EastMaxE_FCheck))
+                reject = REJECT_EFIELD;
 
         /*
           THIS STUFF DOESN'T CONCERN VALID().
@@ -398,44 +1138,94 @@ Capture_Valid(StormProcess_tBOARDDATA* capture)
         /*  Either North or East channel will have the polarity answer.  */
 
         if ((NorthMinE_FCheck != NorthMaxE_FCheck)) {
-                if (capture->NorthMinPos < capture->NorthMaxPos)
-                        capture->EFieldPol = NorthMinE_FCheck;
+                if (peaks->NorthMinPos < peaks->NorthMaxPos)
+                        pol->EFieldPol = NorthMinE_FCheck;
                 else
-                        capture->EFieldPol = NorthMaxE_FCheck;
+                        pol->EFieldPol = NorthMaxE_FCheck;
         }
         else
-                if (capture->EastMinPos < capture->EastMaxPos)
-                        capture->EFieldPol = EastMinE_FCheck;
+                if (peaks->EastMinPos < peaks->EastMaxPos)
+                        pol->EFieldPol = EastMinE_FCheck;
                 else
-                        capture->EFieldPol = EastMaxE_FCheck;
+                        pol->EFieldPol = EastMaxE_FCheck;
 
         /*  Set Polarities: If same polarity as E Field then +1
             If opposite polarity        then -1   */
 
-        if ((capture->NorthMaxPos < capture->NorthMinPos) == capture->EFieldPol)
-                capture->NorthPol = 1;
+        if ((peaks->NorthMaxPos < peaks->NorthMinPos) == pol->EFieldPol)
+                pol->NorthPol = 1;
         else
-                capture->NorthPol = -1;
+                pol->NorthPol = -1;
 
         /*  East polarity is opposite North due to antenna phase connections  */
-        if ((capture->EastMaxPos < capture->EastMinPos) == capture->EFieldPol)
-                capture->EastPol = 1;
+        if ((peaks->EastMaxPos < peaks->EastMinPos) == pol->EFieldPol)
+                pol->EastPol = 1;
         else
-                capture->EastPol = -1;
+                pol->EastPol = -1;
 
-        return CapValid;
+        return reject;
+}
+
+int 
+Capture_Valid(const StormProcess_tPARAMS *params, StormProcess_tBOARDDATA* capture)
+/*
+  Check E-Field Coherency
+  Invalid if E-Field is same polarity at min & max.
+  Returns REJECT_NONE for a strike, or why it is not one
+*/
+{
+        struct capture_peaks peaks;
+        struct capture_pol pol;
+        int reject;
+
+        peaks.NorthMaxPos = capture->NorthMaxPos;
+        peaks.NorthMinPos = capture->NorthMinPos;
+        peaks.EastMaxPos = capture->EastMaxPos;
+        peaks.EastMinPos = capture->EastMinPos;
+        reject = Valid_Decide(params, &peaks,
+                             capture->EFieldBuf[Valid_EFieldPos(params, peaks.NorthMinPos)],
+                             capture->EFieldBuf[Valid_EFieldPos(params, peaks.NorthMaxPos)],
+                             capture->EFieldBuf[Valid_EFieldPos(params, peaks.EastMinPos)],
+                             capture->EFieldBuf[Valid_EFieldPos(params, peaks.EastMaxPos)],
+                             &pol);
+        capture->EFieldPol = pol.EFieldPol;
+        capture->NorthPol = pol.NorthPol;
+        capture->EastPol = pol.EastPol;
+        return reject;
 }
 
 
-static time_t 
-CurrentTime() {
-	time_t now;
-	time(&now);
-	return now;
+void
+Capture_Geometry(const StormProcess_Context *ctx, const StormProcess_tBOARDDATA* capture,
+                 struct strike_geometry *geom)
+{
+        Geometry_Strike(ctx, capture->North_Pk, capture->East_Pk,
+                        capture->NorthPol, capture->EastPol, geom);
+        return;
 }
 
-static StormProcess_tSTRIKE 
-Capture_ConvertToStrike(StormProcess_tBOARDDATA* capture)
+// Geometry_FromPeaks or its replacement for the context's math mode
+void
+Geometry_Strike(const StormProcess_Context *ctx, int North_Pk, int East_Pk,
+                int NorthPol, int EastPol, struct strike_geometry *geom)
+{
+        switch (ctx->math)
+        {
+        case STORMPROCESS_MATH_FAST:
+                Geometry_Fast(&ctx->params, North_Pk, East_Pk, NorthPol, EastPol, geom);
+                return;
+        case STORMPROCESS_MATH_FIXED:
+                Geometry_Fixed(&ctx->fixed, North_Pk, East_Pk, NorthPol, EastPol, geom);
+                return;
+        default:
+                Geometry_FromPeaks(&ctx->params, North_Pk, East_Pk, NorthPol, EastPol, geom);
+                return;
+        }
+}
+
+void
+Geometry_FromPeaks(const StormProcess_tPARAMS *params, int North_Pk, int East_Pk,
+                   int NorthPol, int EastPol, struct strike_geometry *geom)
 /*
   turns raw capture data into strike data
   Generates integer X and Y values for the logfiles.
@@ -472,18 +1262,13 @@ Capture_ConvertToStrike(StormProcess_tBOARDDATA* capture)
   To stretch far strikes back to the edge: mult the result by SuckMultiply
 */
 {
-        static double Average[366]; // average distance[365 degrees+1]
-        static time_t AverageTime[366];  // time when average was set[365 degrees+1]
-  
+        double SuckSubtract = params->r_screen_limit * params->suckin;
         double R_XValue, R_YValue, Divisor;
-        double Delta, Delta2, Delta3, Delta4, Delta5, Delta6, Delta7,
-                MaxDelta, Distance, New_Distance, North_Pk_Real, East_Pk_Real;
+        double Distance, New_Distance, North_Pk_Real, East_Pk_Real;
         double d_bearing;
-        int bearing, adjacentbearing, I_XValue, I_YValue;
-        StormProcess_tSTRIKE new_strike;
 
-        North_Pk_Real = (float)capture->North_Pk;   /*  must convert to real, since we overload integer  */
-        East_Pk_Real = (float)capture->East_Pk;
+        North_Pk_Real = (float)North_Pk;   /*  must convert to real, since we overload integer  */
+        East_Pk_Real = (float)East_Pk;
 
         Divisor = North_Pk_Real * North_Pk_Real + East_Pk_Real * East_Pk_Real;
 
@@ -492,12 +1277,12 @@ Capture_ConvertToStrike(StormProcess_tBOARDDATA* capture)
 
         /*  check for divide by zero  */
         if (Divisor != 0) {
-                R_XValue = capture->EastPol * East_Pk_Real / Divisor;
-                R_YValue = capture->NorthPol * North_Pk_Real / Divisor;
+                R_XValue = EastPol * East_Pk_Real / Divisor;
+                R_YValue = NorthPol * North_Pk_Real / Divisor;
         }
         else {
-                R_XValue = (float)capture->EastPol;   /*  creates an integer of 32256  */
-                R_YValue = (float)capture->NorthPol;   /*  creates an integer of 32256  */
+                R_XValue = (float)EastPol;   /*  creates an integer of 32256  */
+                R_YValue = (float)NorthPol;   /*  creates an integer of 32256  */
         }
 
         /*  CALCULATE STRIKE POSITION  */
@@ -523,15 +1308,14 @@ Capture_ConvertToStrike(StormProcess_tBOARDDATA* capture)
         /*  range checking for safety  */
         if ((d_bearing > 359.0) || (d_bearing < 0.0))
                 d_bearing = 359.0;
-        bearing = (int) d_bearing;
         Distance = (float)sqrt((R_XValue * R_XValue) + (R_YValue * R_YValue));
 
         /*  NOW SUCK IN THE CENTER OF THE SCREEN  */
-        New_Distance = (float)(Distance - SUCKSUBTRACT);
+        New_Distance = (float)(Distance - SuckSubtract);
         /*  check if we sucked past the center  */
         if (New_Distance < 0) New_Distance = 0.0;
         /*  stretch far strikes back to the edge  */
-        New_Distance = (float)(New_Distance * SUCKMULTIPLY);
+        New_Distance = (float)(New_Distance * params->r_screen_limit / (params->r_screen_limit - SuckSubtract));
         /*  Calc the new real X and Y values for this sucked in location  */
         if (Distance != 0) {
                 R_XValue = R_XValue * New_Distance / Distance;
@@ -543,178 +1327,124 @@ Capture_ConvertToStrike(StormProcess_tBOARDDATA* capture)
                 R_YValue = 0.0;
         }
 
-        /*  BACK TO THE AVERAGING  */
-        /*  Check if average = zero. Set average to this strike  */
-        if ( (CurrentTime()-AverageTime[bearing]) > AVERAGEDURATION) {
-		/*  AVERAGE HASN'T BEEN SET YET  */
-                Average[bearing] = New_Distance;
-                AverageTime[bearing] = CurrentTime();   /*  timestamp the average  */
-        }
-        else {
-                /*  FACTOR IN NEW STRIKE  */
-                /*  Calc how much this strike changes our current average  */
-                Delta  = New_Distance - Average[bearing];
-                Delta2 = New_Distance - Average[bearing - 1];   /*  adjacent degree  */
-                Delta3 = New_Distance - Average[bearing + 1];   /*  adjacent degree  */
-                Delta4 = New_Distance - Average[bearing - 2];   /*  adjacent degree  */
-                Delta5 = New_Distance - Average[bearing + 2];   /*  adjacent degree  */
-                Delta6 = New_Distance - Average[bearing - 3];    /*  adjacent degree  */
-                Delta7 = New_Distance - Average[bearing + 3];    /*  adjacent degree  */
-                /* testdelta := Delta; { test  */
-                /*  Limit how much one strike can pull us away from center  */
-                /*  Limit based on strike rate  */
-                MaxDelta = (float)(R_SCREEN_LIMIT / (DELTAPLUSLIMITMVAL *
-                                                     /*strike/min + */  DELTAPLUSLIMITBVAL));
-
-
-                /*  LIMIT FAR STRIKES AND AVERAGE CLOSE STRIKES  */
-                if (Delta > MaxDelta)   /*  this bearing's average  */
-                        Delta = MaxDelta;
-                else
-                        Delta = (float)(Delta * DELTAMINUSFILTERVAL);
-                if (Delta2 > MaxDelta)   /*  adjacent bearing  */
-                        Delta2 = MaxDelta;
-                else
-                        Delta2 = (float)(Delta2 * DELTAMINUSFILTERVAL);
-                if (Delta3 > MaxDelta)   /*  adjacent bearing  */
-                        Delta3 = MaxDelta;
-                else
-                        Delta3 = (float)(Delta3 * DELTAMINUSFILTERVAL);
-                if (Delta4 > MaxDelta)   /*  adjacent bearing  */
-                        Delta4 = MaxDelta;
-                else
-                        Delta4 = (float)(Delta4 * DELTAMINUSFILTERVAL);
-                if (Delta5 > MaxDelta)   /*  adjacent bearing  */
-                        Delta5 = MaxDelta;
-                else
-                        Delta5 = (float)(Delta5 * DELTAMINUSFILTERVAL);
-                if (Delta6 > MaxDelta)               /* adjacent bearing  */
-			Delta6 = MaxDelta;
-                else
-                        Delta6 = (float)(Delta6 * DELTAMINUSFILTERVAL);
-                if (Delta7 > MaxDelta)                    /* adjacent bearing  */
-			Delta7 = MaxDelta;
-                else
-                        Delta7 = (float)(Delta7 * DELTAMINUSFILTERVAL);
-
-                /*  Now Adjust average distance for this new strike  */
-                // 8/24/98 - Elapsed() > AVERAGEDURATION changed to < AVERAGEDURATION
-                Average[bearing] = Average[bearing] + Delta;
-                time_t now = CurrentTime();   /*  in demis, to timestamp averages  */
-                AverageTime[bearing] = now;   /*  timestamp the average  */
-
-                adjacentbearing = bearing - 1; // smooth distances with adjacent bearing
-                if (adjacentbearing < 0 ) adjacentbearing += 360; // wrap around at 0 degrees
-                if ( (now-AverageTime[adjacentbearing]) < AVERAGEDURATION)
-                        Average[adjacentbearing] = Average[adjacentbearing] + Delta2/2;
-                else
-                        Average[adjacentbearing] = Average[bearing];   /*  set adjacent to current  */
-                AverageTime[adjacentbearing] = now;   /*  timestamp the average  */
-
-                adjacentbearing = bearing + 1; // smooth distances with adjacent bearing
-                if (adjacentbearing > 360 ) adjacentbearing -= 360; // wrap around at 0 degrees
-                if ( (now-AverageTime[adjacentbearing]) < AVERAGEDURATION)
-                        Average[adjacentbearing] = Average[adjacentbearing] + Delta3/2;
-                else
-                        Average[adjacentbearing] = Average[bearing];   /*  set adjacent to current  */
-                AverageTime[adjacentbearing] = now;   /*  timestamp the average  */
-
-                adjacentbearing = bearing - 2; // smooth distances with adjacent bearing
-                if (adjacentbearing < 0 ) adjacentbearing += 360; // wrap around at 0 degrees
-                if ( (now-AverageTime[adjacentbearing]) < AVERAGEDURATION)
-                        Average[adjacentbearing] = Average[adjacentbearing] + Delta4/2;
-                else
-                        Average[adjacentbearing] = Average[bearing];   /*  set adjacent to current  */
-                AverageTime[adjacentbearing] = now;   /*  timestamp the average  */
-
-                adjacentbearing = bearing + 2; // smooth distances with adjacent bearing
-                if (adjacentbearing > 360 ) adjacentbearing -= 360; // wrap around at 0 degrees
-                if ( (now-AverageTime[adjacentbearing]) < AVERAGEDURATION)
-                        Average[adjacentbearing] = Average[adjacentbearing] + Delta5/2;
-                else
-                        Average[adjacentbearing] = Average[bearing];   /*  set adjacent to current  */
-                AverageTime[adjacentbearing] = now;   /*  timestamp the average  */
-
-                adjacentbearing = bearing - 3; // smooth distances with adjacent bearing
-                if (adjacentbearing < 0 ) adjacentbearing += 360; // wrap around at 0 degrees
-                if ( (now-AverageTime[adjacentbearing]) < AVERAGEDURATION)
-                        Average[adjacentbearing] = Average[adjacentbearing] + Delta6/2;
-                else
-                        Average[adjacentbearing] = Average[bearing];   /*  set adjacent to current  */
-                AverageTime[adjacentbearing] = now;   /*  timestamp the average  */
-
-                adjacentbearing = bearing + 3; // smooth distances with adjacent bearing
-                if (adjacentbearing > 360 ) adjacentbearing -= 360; // wrap around at 0 degrees
-                if ( (now-AverageTime[adjacentbearing]) < AVERAGEDURATION)
-                        Average[adjacentbearing] = Average[adjacentbearing] + Delta7/2;
-                else
-                        Average[adjacentbearing] = Average[bearing];   /*  set adjacent to current  */
-                AverageTime[adjacentbearing] = now;   /*  timestamp the average  */
-
-                /*  Now adjust this strike to the current average  */
-                /*  scale X and Y according to the ratio of old Average to New_Averge  */
-
-                if (New_Distance != 0) {
-                        R_XValue = R_XValue * Average[bearing] / New_Distance;
-                        R_YValue = R_YValue * Average[bearing] / New_Distance;
-		}
-                else {
-                        /*  Distance for this strike is zero,
-                            so we can't just scale the current values, must calculate them  */
-                        R_XValue = (float)(-cos(bearing / 57.296) * Average[bearing]);   /*  angle in radians  */
-                        R_YValue = (float)(-sin(bearing / 57.296) * Average[bearing]);   /*  angle in radians  */
-                }
-        } /* END FACTOR IN NEW STRIKE */
-
-        /*  Check that number will not overflow/underflow integer  */
-        /*  Limit value to 7648. Since we are storing data in file at -+32xVGA  */
-        /*  resolution this will limit strikes to near edge of screen  */
-        if (R_XValue > R_SCREEN_LIMIT) R_XValue = (float)R_SCREEN_LIMIT;
-        if (R_XValue < -R_SCREEN_LIMIT) R_XValue = (float)-R_SCREEN_LIMIT;
-        if (R_YValue > R_SCREEN_LIMIT) R_YValue = (float)R_SCREEN_LIMIT;
-        if (R_YValue < -R_SCREEN_LIMIT) R_YValue = (float)-R_SCREEN_LIMIT;
-
-        /*  Convert to uint variable type, as required by datafile  */
-        /*                  scaling constant * 16xVGA resolution  */
-        /* I_XValue := trunc(R_XValue * 3960 * 16); displays 40% too close  */
-        /* I_YValue := trunc(R_YValue * 3960 * 16);  */
-        /* I_XValue := trunc(R_XValue * 3960.0 * 24.0); { displays 25% to far  */
-        /* I_YValue := trunc(R_YValue * 3960.0 * 24.0);   */
-        I_XValue = (int)(R_XValue * 3960.0 * SCREENSCALINGCONSTANT);
-        I_YValue = (int)(R_YValue * 3960.0 * SCREENSCALINGCONSTANT);
+        geom->R_XValue = R_XValue;
+        geom->R_YValue = R_YValue;
+        geom->New_Distance = New_Distance;
+        geom->d_bearing = d_bearing;
+        return;
+}
 
-        new_strike.distance = (float)New_Distance; // unaveraged
-        new_strike.distance_averaged = (float)(Average[bearing] / MILESCONSTANT); // store distance in miles;
-        new_strike.direction = (float)d_bearing;
+static StormProcess_tSTRIKE 
+Capture_ConvertToStrike(StormProcess_Context *ctx, StormProcess_tBOARDDATA* capture)
+/*
+  turns raw capture data into strike data, see Capture_Geometry()
+  and Capture_Average()
+*/
+{
+        struct strike_geometry geom;
 
-        return new_strike;
-} 
+        Capture_Geometry(ctx, capture, &geom);
+        geom.time = Average_Clock(&capture->lts2_data);
+        return Capture_Average(ctx, &geom);
+}
 
 
 //==================================================================
-// Perform a single-site strike position calculation
+// Perform a single-site strike position calculation. Noise is turned
+// away by Capture_Valid before the strike position and the bearing
+// averages are worked out
 //
 StormProcess_tSTRIKE 
-StormProcess_SSProcessCapture(StormProcess_tBOARDDATA* capture)
+StormProcess_SSProcessCaptureCtx(StormProcess_Context *ctx, StormProcess_tBOARDDATA* capture)
 {
 	StormProcess_tSTRIKE strike;
         
 	Capture_Filter(capture);
 	Capture_Find_Peaks(capture);
 	
-	strike.valid = Capture_Valid(capture); // looks like a strike?
+	if (Capture_Count(ctx, Capture_Valid(&ctx->params, capture))) // looks like a strike?
+                return Capture_Rejected();
 	
-	return Capture_ConvertToStrike(capture);
+	strike = Capture_ConvertToStrike(ctx, capture);
+	strike.valid = 1;
+	return strike;
 }
 
+StormProcess_tSTRIKE 
+StormProcess_SSProcessCapture(StormProcess_tBOARDDATA* capture)
+{
+        return StormProcess_SSProcessCaptureCtx(&default_process_context, capture);
+}
 
-// retrieve the waiting capture
-void StormPCI_GetBoardData(StormProcess_tPACKEDDATA * board_data)
+// Filter, Find_Peaks, Valid and Geometry in one pass over the packed
+// words: the filter is applied as the peaks are searched, and only the
+// handful of samples the later stages look at are read again. Returns
+// REJECT_NONE for a strike; noise is turned away as soon as a check
+// fails, geom is only set for strikes
+int
+Capture_Packed(const StormProcess_Context *ctx, const StormProcess_tPACKEDDATA *packed,
+               struct strike_geometry *geom)
 {
-        /* struct stormpci_packed_data aka StormProcess_tPACKEDDATA */
-        if (fd == -1) return;
+        const StormProcess_tPARAMS *params = &ctx->params;
+        const __u16 *north_raw = packed->usNorth, *east_raw = packed->usWest;
+        struct peak_scan north, east;
+        struct capture_peaks peaks;
+        struct capture_pol pol;
+        StormProcess_tTIMESTAMPINFO ts;
+        int other_pk, reject;
+
+        Fused_Scan(packed, &north, &east);
+        Peaks_Positions(&north, &east, &peaks);
+        if (Peaks_NorthWins(&north, &east))
+                other_pk = Fused_Filtered(east_raw, peaks.NorthMaxPos) - Fused_Filtered(east_raw, peaks.NorthMinPos);
+        else
+                other_pk = Fused_Filtered(north_raw, peaks.EastMaxPos) - Fused_Filtered(north_raw, peaks.EastMinPos);
+        Peaks_Resolve(&north, &east, other_pk, &peaks);
+
+        /*  the positions the checks look at are only final now  */
+        if (!Valid_Frequency(params, &peaks))
+                return REJECT_FREQUENCY;
+
+        /*  the E-field is bit 8 of the north words  */
+        reject = Valid_Decide(params, &peaks,
+                              (north_raw[Valid_EFieldPos(params, peaks.NorthMinPos)] >> 8) & 1,
+                              (north_raw[Valid_EFieldPos(params, peaks.NorthMaxPos)] >> 8) & 1,
+                              (north_raw[Valid_EFieldPos(params, peaks.EastMinPos)] >> 8) & 1,
+                              (north_raw[Valid_EFieldPos(params, peaks.EastMaxPos)] >> 8) & 1,
+                              &pol);
+        if (reject)
+                return reject;
+
+        Geometry_Strike(ctx, peaks.North_Pk, peaks.East_Pk, pol.NorthPol, pol.EastPol, geom);
+
+        /*  the GPS record is only needed for the date of a good timestamp  */
+        Extract_Timestamp(packed, &ts);
+        if (ts.TS_valid)
+                Extract_GPS(packed, &ts);
+        else
+                ts.gps_data_valid = 0;
+        geom->time = Average_Clock(&ts);
+        return REJECT_NONE;
+}
 
-        ioctl (fd, BOLTEK_IOCTL_GET_DATA, board_data);
-        return;
+//==================================================================
+// The same strike as unpacking the capture and passing it to
+// StormProcess_SSProcessCaptureCtx, without the unpacked copy. Of the
+// timestamp and GPS data only the capture's time is wanted, for the
+// bearing averages: the GPS record is decoded (or found in the per
+// thread cache) only when the timestamp is good.
+//
+StormProcess_tSTRIKE
+StormProcess_ProcessPacked(StormProcess_Context *ctx, const StormProcess_tPACKEDDATA *packed)
+{
+        struct strike_geometry geom;
+        StormProcess_tSTRIKE strike;
+
+        if (Capture_Count(ctx, Capture_Packed(ctx, packed, &geom)))
+                return Capture_Rejected();
+        strike = Capture_Average(ctx, &geom);
+        strike.valid = 1;
+        return strike;
 }
 
+
@@ -0,0 +1,295 @@
+/* Replay backends for the Boltek Lightning Detector SDK
+   Feed previously recorded captures through the StormPCI_* API so the
+   processing chain can be run and measured without a card.
+*/
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "stormpci.h"
+#include "stormpci_int.h"
+
+struct replay_source
+{
+        const StormProcess_tPACKEDDATA *captures;
+        size_t count;
+        size_t next;            // capture handed out by the next GetBoardData
+        int flags;
+
+        double last_time;       // capture time of captures[next], 0 until one has a time, paced only
+        double due;             // monotonic time captures[next] is ready, paced only
+
+        char *filename;         // NULL for the memory backend
+        void *map;
+        size_t maplen;
+};
+
+
+static double
+MonotonicTime(void)
+{
+        struct timespec ts;
+
+        clock_gettime (CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// seconds since the epoch the capture was triggered at, or previous
+// if the capture doesn't carry a usable timestamp
+static double
+CaptureTime(const StormProcess_tPACKEDDATA *packed, double previous)
+{
+        StormProcess_tTIMESTAMPINFO ts = ExtractGPSData(packed);
+        double seconds;
+
+        return Timestamp_Seconds(&ts, &seconds) ? seconds : previous;
+}
+
+static void
+Replay_Rewind(struct replay_source *src)
+{
+        src->next = 0;
+        if ((src->flags & STORMPCI_REPLAY_PACED) && src->count)
+        {
+                src->due = MonotonicTime();
+                src->last_time = CaptureTime(&src->captures[0], 0.0);
+        }
+        return;
+}
+
+static int
+Replay_Ready(struct replay_source *src)
+{
+        if (src->next >= src->count) return 0;
+        if (src->flags & STORMPCI_REPLAY_PACED)
+                return MonotonicTime() >= src->due;
+        return 1;
+}
+
+static int
+Replay_Open(void *priv)
+{
+        struct replay_source *src = priv;
+        struct stat st;
+        int lfd;
+
+        if (src->filename)
+        {
+                lfd = open (src->filename, O_RDONLY);
+                if (lfd == -1) return 0;
+                if (fstat (lfd, &st) == -1 || st.st_size < (off_t) sizeof(StormProcess_tPACKEDDATA))
+                {
+                        close (lfd);
+                        return 0;
+                }
+                src->maplen = st.st_size;
+                src->map = mmap (NULL, src->maplen, PROT_READ, MAP_PRIVATE, lfd, 0);
+                close (lfd);
+                if (src->map == MAP_FAILED)
+                {
+                        src->map = NULL;
+                        return 0;
+                }
+                src->captures = src->map;
+                src->count = src->maplen / sizeof(StormProcess_tPACKEDDATA);
+        }
+        Replay_Rewind(src);
+        return 1;
+}
+
+static void
+Replay_Close(void *priv)
+{
+        struct replay_source *src = priv;
+
+        if (src->map)
+        {
+                munmap (src->map, src->maplen);
+                src->map = NULL;
+                src->captures = NULL;
+                src->count = 0;
+        }
+        return;
+}
+
+static void
+Replay_Release(void *priv)
+{
+        struct replay_source *src = priv;
+
+        free (src->filename);
+        free (src);
+        return;
+}
+
+// move on to the next capture, but only if the current one was delivered
+static void
+Replay_Restart(void *priv)
+{
+        struct replay_source *src = priv;
+        double t;
+
+        if (!Replay_Ready(src)) return;
+
+        if (++src->next == src->count && (src->flags & STORMPCI_REPLAY_LOOP))
+        {
+                Replay_Rewind(src);
+                return;
+        }
+        if ((src->flags & STORMPCI_REPLAY_PACED) && src->next < src->count)
+        {
+                /* captures from before the GPS lock come as fast as the
+                   first, the gap to them is unknown */
+                t = CaptureTime(&src->captures[src->next], src->last_time);
+                if (src->last_time > 0.0 && t > src->last_time)
+                        src->due += t - src->last_time;
+                src->last_time = t;
+        }
+        return;
+}
+
+// a paced replay delivers the next capture right away
+static void
+Replay_ForceTrigger(void *priv)
+{
+        struct replay_source *src = priv;
+
+        if (src->flags & STORMPCI_REPLAY_PACED)
+                src->due = MonotonicTime();
+        return;
+}
+
+static int
+Replay_StrikeReady(void *priv)
+{
+        return Replay_Ready(priv);
+}
+
+// sleep until the next capture is due, a replay that has run dry
+// returns straight away
+static int
+Replay_WaitForStrike(void *priv, int timeout_ms)
+{
+        struct replay_source *src = priv;
+        struct timespec ts;
+        double wait;
+
+        if (src->next >= src->count) return 0;
+        if (!(src->flags & STORMPCI_REPLAY_PACED)) return 1;
+
+        wait = src->due - MonotonicTime();
+        if (timeout_ms >= 0 && wait > timeout_ms / 1000.0)
+                wait = timeout_ms / 1000.0;
+        if (wait > 0)
+        {
+                ts.tv_sec = (time_t) wait;
+                ts.tv_nsec = (long) ((wait - ts.tv_sec) * 1e9);
+                nanosleep (&ts, NULL);
+        }
+        return Replay_Ready(src);
+}
+
+static int
+Replay_SetSquelch(void *priv, char trig_level)
+{
+        return 1;
+}
+
+static int
+Replay_GetData(void *priv, StormProcess_tPACKEDDATA *board_data)
+{
+        struct replay_source *src = priv;
+
+        if (src->next >= src->count) return 0;
+        memcpy (board_data, &src->captures[src->next], sizeof(*board_data));
+        return 1;
+}
+
+// captures are handed out in place, from the caller's array or the mapped file
+static const StormProcess_tPACKEDDATA *
+Replay_PeekData(void *priv)
+{
+        struct replay_source *src = priv;
+
+        if (!Replay_Ready(src)) return NULL;
+        return &src->captures[src->next];
+}
+
+// a looping replay starts over instead
+static int
+Replay_Exhausted(void *priv)
+{
+        struct replay_source *src = priv;
+
+        return src->next >= src->count;
+}
+
+static const StormPCI_tBACKEND replay_backend =
+{
+        "replay",
+        Replay_Open,
+        Replay_Close,
+        Replay_Release,
+        Replay_Restart,
+        Replay_ForceTrigger,
+        Replay_StrikeReady,
+        Replay_SetSquelch,
+        Replay_GetData,
+        Replay_WaitForStrike,
+        Replay_PeekData,
+        Replay_Restart,
+        NULL,
+        Replay_Exhausted,
+};
+
+
+// replay a capture file - non-zero on success
+int StormPCI_UseReplayFileCtx(StormPCI_Context *ctx, const char *filename, int flags)
+{
+        struct replay_source *src;
+
+        src = calloc (1, sizeof(*src));
+        if (src == NULL) return 0;
+        src->flags = flags;
+        src->filename = strdup (filename);
+        if (src->filename == NULL || !StormPCI_UseBackendCtx(ctx, &replay_backend, src))
+        {
+                Replay_Release(src);
+                return 0;
+        }
+        return 1;
+}
+
+// replay captures held in memory - non-zero on success
+int StormPCI_UseMemoryCtx(StormPCI_Context *ctx, const StormProcess_tPACKEDDATA *captures, size_t count, int flags)
+{
+        struct replay_source *src;
+
+        src = calloc (1, sizeof(*src));
+        if (src == NULL) return 0;
+        src->flags = flags;
+        src->captures = captures;
+        src->count = count;
+        if (!StormPCI_UseBackendCtx(ctx, &replay_backend, src))
+        {
+                Replay_Release(src);
+                return 0;
+        }
+        return 1;
+}
+
+int StormPCI_UseReplayFile(const char *filename, int flags)
+{
+        return StormPCI_UseReplayFileCtx(StormPCI_DefaultContext(), filename, flags);
+}
+
+int StormPCI_UseMemory(const StormProcess_tPACKEDDATA *captures, size_t count, int flags)
+{
+        return StormPCI_UseMemoryCtx(StormPCI_DefaultContext(), captures, count, flags);
+}
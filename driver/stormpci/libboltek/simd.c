@@ -0,0 +1,786 @@
+/* Vector kernels for the Boltek Lightning Detector SDK
+   Each kernel has a portable C version and SSE2, AVX2 or NEON versions
+   where the compiler can build them. The best one the cpu supports is
+   picked at run time, so one binary runs everywhere.
+*/
+
+#include "stormpci.h"
+#include "stormpci_int.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SIMD_X86 1
+#elif defined(__aarch64__) || (defined(__arm__) && defined(__ARM_NEON))
+#include <arm_neon.h>
+#define SIMD_ARM 1
+#elif defined(__arm__) && defined(__ARM_FP) && defined(__GNUC__) && __GNUC__ >= 8 && !defined(__clang__)
+// 32 bit arm built without -mfpu=neon, as the armhf distributions for
+// the Raspberry Pi are: gcc builds the NEON kernels for it anyway, and
+// they are used only if the kernel reports the cpu has NEON
+#include <arm_neon.h>
+#include <sys/auxv.h>
+#ifndef HWCAP_ARM_NEON
+#define HWCAP_ARM_NEON (1 << 12)
+#endif
+#define SIMD_ARM 1
+#define SIMD_NEON_HWCAP 1
+#define SIMD_NEON_TARGET __attribute__((target("fpu=neon")))
+#endif
+
+#ifndef SIMD_NEON_TARGET
+#define SIMD_NEON_TARGET
+#endif
+
+static int simd_limit = SIMD_AVX2;      // Simd_Limit()
+static int simd_detected = -1;          // SIMD_* once the cpu has been checked
+
+static int
+Simd_Detect(void)
+{
+#if SIMD_X86
+        __builtin_cpu_init ();
+        if (__builtin_cpu_supports ("avx2")) return SIMD_AVX2;
+        if (__builtin_cpu_supports ("sse2")) return SIMD_SSE2;
+#elif SIMD_NEON_HWCAP
+        if (getauxval (AT_HWCAP) & HWCAP_ARM_NEON) return SIMD_NEON;
+#elif SIMD_ARM
+        // part of the base architecture on aarch64, and the compiler was
+        // told it may assume it for 32 bit arm
+        return SIMD_NEON;
+#endif
+        return SIMD_NONE;
+}
+
+// the best kernels to use, detecting the cpu on the first call. Threads
+// racing here all store the same answer
+int
+Simd_Level(void)
+{
+        int level = __atomic_load_n (&simd_detected, __ATOMIC_RELAXED);
+
+        if (level < 0)
+        {
+                level = Simd_Detect();
+                __atomic_store_n (&simd_detected, level, __ATOMIC_RELAXED);
+        }
+        // an AVX2 cpu limited to SSE2 still has SSE2
+        if (level > simd_limit)
+                level = level == SIMD_AVX2 && simd_limit >= SIMD_SSE2 ? SIMD_SSE2 : SIMD_NONE;
+        return level;
+}
+
+// use no better than level, SIMD_NONE for the portable C kernels. For
+// benchmarks and for checking the kernels against each other
+void
+Simd_Limit(int level)
+{
+        simd_limit = level;
+        return;
+}
+
+
+//==================================================================
+// Unpack: the low byte of usNorth and usWest are the north and east
+// samples, bit 8 of usNorth the E-field.
+//
+static void
+Unpack_C(const __u16 *north, const __u16 *west, StormProcess_tBOARDDATA *board)
+{
+        int cnt;
+
+        for (cnt = 0; cnt < BOLTEK_BUFFERSIZE; cnt++)
+        {
+                board->NorthBuf[cnt] = north[cnt] & 0xff;
+                board->EastBuf[cnt] = west[cnt] & 0xff;
+                board->EFieldBuf[cnt] = (north[cnt] & 0x0100) == 0x100;
+        }
+        return;
+}
+
+#if SIMD_X86
+__attribute__((target("sse2")))
+static void
+Unpack_SSE2(const __u16 *north, const __u16 *west, StormProcess_tBOARDDATA *board)
+{
+        const __m128i low = _mm_set1_epi16 (0xff), one = _mm_set1_epi16 (1), zero = _mm_setzero_si128 ();
+        __m128i n, w, e;
+        int cnt;
+
+        for (cnt = 0; cnt < BOLTEK_BUFFERSIZE; cnt += 8)
+        {
+                n = _mm_loadu_si128 ((const __m128i *) &north[cnt]);
+                w = _mm_loadu_si128 ((const __m128i *) &west[cnt]);
+                e = _mm_and_si128 (_mm_srli_epi16 (n, 8), one);
+                n = _mm_and_si128 (n, low);
+                w = _mm_and_si128 (w, low);
+                _mm_storeu_si128 ((__m128i *) &board->NorthBuf[cnt], _mm_unpacklo_epi16 (n, zero));
+                _mm_storeu_si128 ((__m128i *) &board->NorthBuf[cnt + 4], _mm_unpackhi_epi16 (n, zero));
+                _mm_storeu_si128 ((__m128i *) &board->EastBuf[cnt], _mm_unpacklo_epi16 (w, zero));
+                _mm_storeu_si128 ((__m128i *) &board->EastBuf[cnt + 4], _mm_unpackhi_epi16 (w, zero));
+                _mm_storeu_si128 ((__m128i *) &board->EFieldBuf[cnt], _mm_unpacklo_epi16 (e, zero));
+                _mm_storeu_si128 ((__m128i *) &board->EFieldBuf[cnt + 4], _mm_unpackhi_epi16 (e, zero));
+        }
+        return;
+}
+
+__attribute__((target("avx2")))
+static void
+Unpack_AVX2(const __u16 *north, const __u16 *west, StormProcess_tBOARDDATA *board)
+{
+        const __m256i low = _mm256_set1_epi32 (0xff), one = _mm256_set1_epi32 (1);
+        __m256i n, w;
+        int cnt;
+
+        for (cnt = 0; cnt < BOLTEK_BUFFERSIZE; cnt += 8)
+        {
+                n = _mm256_cvtepu16_epi32 (_mm_loadu_si128 ((const __m128i *) &north[cnt]));
+                w = _mm256_cvtepu16_epi32 (_mm_loadu_si128 ((const __m128i *) &west[cnt]));
+                _mm256_storeu_si256 ((__m256i *) &board->NorthBuf[cnt], _mm256_and_si256 (n, low));
+                _mm256_storeu_si256 ((__m256i *) &board->EastBuf[cnt], _mm256_and_si256 (w, low));
+                _mm256_storeu_si256 ((__m256i *) &board->EFieldBuf[cnt],
+                                     _mm256_and_si256 (_mm256_srli_epi32 (n, 8), one));
+        }
+        return;
+}
+#endif
+
+#if SIMD_ARM
+SIMD_NEON_TARGET
+static void
+Unpack_NEON(const __u16 *north, const __u16 *west, StormProcess_tBOARDDATA *board)
+{
+        const uint16x8_t low = vdupq_n_u16 (0xff), one = vdupq_n_u16 (1);
+        uint16x8_t n, w, e;
+        int cnt;
+
+        for (cnt = 0; cnt < BOLTEK_BUFFERSIZE; cnt += 8)
+        {
+                n = vld1q_u16 (&north[cnt]);
+                w = vld1q_u16 (&west[cnt]);
+                e = vandq_u16 (vshrq_n_u16 (n, 8), one);
+                n = vandq_u16 (n, low);
+                w = vandq_u16 (w, low);
+                vst1q_s32 (&board->NorthBuf[cnt], vreinterpretq_s32_u32 (vmovl_u16 (vget_low_u16 (n))));
+                vst1q_s32 (&board->NorthBuf[cnt + 4], vreinterpretq_s32_u32 (vmovl_u16 (vget_high_u16 (n))));
+                vst1q_s32 (&board->EastBuf[cnt], vreinterpretq_s32_u32 (vmovl_u16 (vget_low_u16 (w))));
+                vst1q_s32 (&board->EastBuf[cnt + 4], vreinterpretq_s32_u32 (vmovl_u16 (vget_high_u16 (w))));
+                vst1q_s32 (&board->EFieldBuf[cnt], vreinterpretq_s32_u32 (vmovl_u16 (vget_low_u16 (e))));
+                vst1q_s32 (&board->EFieldBuf[cnt + 4], vreinterpretq_s32_u32 (vmovl_u16 (vget_high_u16 (e))));
+        }
+        return;
+}
+#endif
+
+// the sample half of StormProcess_UnpackCaptureData
+void
+Unpack_Samples(const StormProcess_tPACKEDDATA *packed, StormProcess_tBOARDDATA *board)
+{
+        switch (Simd_Level())
+        {
+#if SIMD_X86
+        case SIMD_AVX2:
+                Unpack_AVX2(packed->usNorth, packed->usWest, board);
+                return;
+        case SIMD_SSE2:
+                Unpack_SSE2(packed->usNorth, packed->usWest, board);
+                return;
+#endif
+#if SIMD_ARM
+        case SIMD_NEON:
+                Unpack_NEON(packed->usNorth, packed->usWest, board);
+                return;
+#endif
+        default:
+                Unpack_C(packed->usNorth, packed->usWest, board);
+                return;
+        }
+}
+
+
+//==================================================================
+// Peaks: Peaks_Scan_C for both channels in one pass. Each lane keeps
+// the first position it saw its max and min at, which is strict > and
+// < as in the C loop; ties between lanes then go to the lowest
+// position, so the results are the same to the sample.
+//
+#define SCAN_FIRST 8    /*  the C loop covers 3..7, vectors the rest  */
+
+// scan from the vector lanes, the head samples in scan came first
+static void
+Peaks_Merge(struct peak_scan *scan, const int *max, const int *max_pos,
+            const int *min, const int *min_pos, const int *clip_pos, const int *clip_neg, int lanes)
+{
+        int lane;
+
+        for (lane = 0; lane < lanes; lane++)
+        {
+                if (max[lane] > scan->max ||
+                    (max[lane] == scan->max && max_pos[lane] < scan->max_pos && max_pos[lane] >= SCAN_FIRST))
+                {
+                        scan->max = max[lane];
+                        scan->max_pos = max_pos[lane];
+                }
+                if (min[lane] < scan->min ||
+                    (min[lane] == scan->min && min_pos[lane] < scan->min_pos && min_pos[lane] >= SCAN_FIRST))
+                {
+                        scan->min = min[lane];
+                        scan->min_pos = min_pos[lane];
+                }
+                scan->clip_pos += clip_pos[lane];
+                scan->clip_neg += clip_neg[lane];
+        }
+        return;
+}
+
+// the samples before SCAN_FIRST, which is where every scan starts
+static void
+Peaks_Head(const int *buf, struct peak_scan *scan)
+{
+        int Count;
+
+        scan->max = 0;
+        scan->min = 32000;
+        scan->max_pos = scan->min_pos = 3;
+        scan->clip_pos = scan->clip_neg = 0;
+        for (Count = 3; Count < SCAN_FIRST; Count++)
+        {
+                if (buf[Count] > scan->max)
+                {
+                        scan->max = buf[Count];
+                        scan->max_pos = Count;
+                }
+                if (buf[Count] < scan->min)
+                {
+                        scan->min = buf[Count];
+                        scan->min_pos = Count;
+                }
+                scan->clip_pos += buf[Count] == MAXBUFVAL;
+                scan->clip_neg += buf[Count] == 0;
+        }
+        return;
+}
+
+#if SIMD_X86
+__attribute__((target("sse2")))
+static inline __m128i
+Select_SSE2(__m128i mask, __m128i a, __m128i b)
+{
+        return _mm_or_si128 (_mm_and_si128 (mask, a), _mm_andnot_si128 (mask, b));
+}
+
+__attribute__((target("sse2")))
+static void
+Peaks_Scan_SSE2(const int *buf, struct peak_scan *scan)
+{
+        int max[4], max_pos[4], min[4], min_pos[4], clip_pos[4], clip_neg[4];
+        __m128i vmax = _mm_set1_epi32 (scan->max), vmin = _mm_set1_epi32 (scan->min);
+        __m128i vmax_pos = _mm_set1_epi32 (-1), vmin_pos = _mm_set1_epi32 (-1);
+        __m128i vclip_pos = _mm_setzero_si128 (), vclip_neg = _mm_setzero_si128 ();
+        const __m128i top = _mm_set1_epi32 (MAXBUFVAL), zero = _mm_setzero_si128 (), four = _mm_set1_epi32 (4);
+        __m128i pos = _mm_setr_epi32 (SCAN_FIRST, SCAN_FIRST + 1, SCAN_FIRST + 2, SCAN_FIRST + 3);
+        __m128i v, gt, lt;
+        int cnt;
+
+        for (cnt = SCAN_FIRST; cnt < BOLTEK_BUFFERSIZE; cnt += 4)
+        {
+                v = _mm_loadu_si128 ((const __m128i *) &buf[cnt]);
+                gt = _mm_cmpgt_epi32 (v, vmax);
+                lt = _mm_cmplt_epi32 (v, vmin);
+                vmax = Select_SSE2(gt, v, vmax);
+                vmax_pos = Select_SSE2(gt, pos, vmax_pos);
+                vmin = Select_SSE2(lt, v, vmin);
+                vmin_pos = Select_SSE2(lt, pos, vmin_pos);
+                // compares give -1 per matching lane
+                vclip_pos = _mm_sub_epi32 (vclip_pos, _mm_cmpeq_epi32 (v, top));
+                vclip_neg = _mm_sub_epi32 (vclip_neg, _mm_cmpeq_epi32 (v, zero));
+                pos = _mm_add_epi32 (pos, four);
+        }
+        _mm_storeu_si128 ((__m128i *) max, vmax);
+        _mm_storeu_si128 ((__m128i *) max_pos, vmax_pos);
+        _mm_storeu_si128 ((__m128i *) min, vmin);
+        _mm_storeu_si128 ((__m128i *) min_pos, vmin_pos);
+        _mm_storeu_si128 ((__m128i *) clip_pos, vclip_pos);
+        _mm_storeu_si128 ((__m128i *) clip_neg, vclip_neg);
+        Peaks_Merge(scan, max, max_pos, min, min_pos, clip_pos, clip_neg, 4);
+        return;
+}
+
+__attribute__((target("avx2")))
+static void
+Peaks_Scan_AVX2(const int *buf, struct peak_scan *scan)
+{
+        int max[8], max_pos[8], min[8], min_pos[8], clip_pos[8], clip_neg[8];
+        __m256i vmax = _mm256_set1_epi32 (scan->max), vmin = _mm256_set1_epi32 (scan->min);
+        __m256i vmax_pos = _mm256_set1_epi32 (-1), vmin_pos = _mm256_set1_epi32 (-1);
+        __m256i vclip_pos = _mm256_setzero_si256 (), vclip_neg = _mm256_setzero_si256 ();
+        const __m256i top = _mm256_set1_epi32 (MAXBUFVAL), zero = _mm256_setzero_si256 (), eight = _mm256_set1_epi32 (8);
+        __m256i pos = _mm256_add_epi32 (_mm256_set1_epi32 (SCAN_FIRST), _mm256_setr_epi32 (0, 1, 2, 3, 4, 5, 6, 7));
+        __m256i v, gt, lt;
+        int cnt;
+
+        for (cnt = SCAN_FIRST; cnt < BOLTEK_BUFFERSIZE; cnt += 8)
+        {
+                v = _mm256_loadu_si256 ((const __m256i *) &buf[cnt]);
+                gt = _mm256_cmpgt_epi32 (v, vmax);
+                lt = _mm256_cmpgt_epi32 (vmin, v);
+                vmax = _mm256_max_epi32 (v, vmax);
+                vmax_pos = _mm256_blendv_epi8 (vmax_pos, pos, gt);
+                vmin = _mm256_min_epi32 (v, vmin);
+                vmin_pos = _mm256_blendv_epi8 (vmin_pos, pos, lt);
+                vclip_pos = _mm256_sub_epi32 (vclip_pos, _mm256_cmpeq_epi32 (v, top));
+                vclip_neg = _mm256_sub_epi32 (vclip_neg, _mm256_cmpeq_epi32 (v, zero));
+                pos = _mm256_add_epi32 (pos, eight);
+        }
+        _mm256_storeu_si256 ((__m256i *) max, vmax);
+        _mm256_storeu_si256 ((__m256i *) max_pos, vmax_pos);
+        _mm256_storeu_si256 ((__m256i *) min, vmin);
+        _mm256_storeu_si256 ((__m256i *) min_pos, vmin_pos);
+        _mm256_storeu_si256 ((__m256i *) clip_pos, vclip_pos);
+        _mm256_storeu_si256 ((__m256i *) clip_neg, vclip_neg);
+        Peaks_Merge(scan, max, max_pos, min, min_pos, clip_pos, clip_neg, 8);
+        return;
+}
+#endif
+
+#if SIMD_ARM
+SIMD_NEON_TARGET
+static void
+Peaks_Scan_NEON(const int *buf, struct peak_scan *scan)
+{
+        int max[4], max_pos[4], min[4], min_pos[4], clip_pos[4], clip_neg[4];
+        int32x4_t vmax = vdupq_n_s32 (scan->max), vmin = vdupq_n_s32 (scan->min);
+        int32x4_t vmax_pos = vdupq_n_s32 (-1), vmin_pos = vdupq_n_s32 (-1);
+        int32x4_t vclip_pos = vdupq_n_s32 (0), vclip_neg = vdupq_n_s32 (0);
+        const int32x4_t top = vdupq_n_s32 (MAXBUFVAL), zero = vdupq_n_s32 (0), four = vdupq_n_s32 (4);
+        static const int first[4] = { SCAN_FIRST, SCAN_FIRST + 1, SCAN_FIRST + 2, SCAN_FIRST + 3 };
+        int32x4_t pos = vld1q_s32 (first);
+        int32x4_t v;
+        uint32x4_t gt, lt;
+        int cnt;
+
+        for (cnt = SCAN_FIRST; cnt < BOLTEK_BUFFERSIZE; cnt += 4)
+        {
+                v = vld1q_s32 (&buf[cnt]);
+                gt = vcgtq_s32 (v, vmax);
+                lt = vcltq_s32 (v, vmin);
+                vmax = vmaxq_s32 (v, vmax);
+                vmax_pos = vbslq_s32 (gt, pos, vmax_pos);
+                vmin = vminq_s32 (v, vmin);
+                vmin_pos = vbslq_s32 (lt, pos, vmin_pos);
+                vclip_pos = vsubq_s32 (vclip_pos, vreinterpretq_s32_u32 (vceqq_s32 (v, top)));
+                vclip_neg = vsubq_s32 (vclip_neg, vreinterpretq_s32_u32 (vceqq_s32 (v, zero)));
+                pos = vaddq_s32 (pos, four);
+        }
+        vst1q_s32 (max, vmax);
+        vst1q_s32 (max_pos, vmax_pos);
+        vst1q_s32 (min, vmin);
+        vst1q_s32 (min_pos, vmin_pos);
+        vst1q_s32 (clip_pos, vclip_pos);
+        vst1q_s32 (clip_neg, vclip_neg);
+        Peaks_Merge(scan, max, max_pos, min, min_pos, clip_pos, clip_neg, 4);
+        return;
+}
+#endif
+
+// Peaks_Scan_C for both channels
+void
+Peaks_Scan(const int *north, const int *east, struct peak_scan *north_scan, struct peak_scan *east_scan)
+{
+        switch (Simd_Level())
+        {
+#if SIMD_X86
+        case SIMD_AVX2:
+                Peaks_Head(north, north_scan);
+                Peaks_Head(east, east_scan);
+                Peaks_Scan_AVX2(north, north_scan);
+                Peaks_Scan_AVX2(east, east_scan);
+                return;
+        case SIMD_SSE2:
+                Peaks_Head(north, north_scan);
+                Peaks_Head(east, east_scan);
+                Peaks_Scan_SSE2(north, north_scan);
+                Peaks_Scan_SSE2(east, east_scan);
+                return;
+#endif
+#if SIMD_ARM
+        case SIMD_NEON:
+                Peaks_Head(north, north_scan);
+                Peaks_Head(east, east_scan);
+                Peaks_Scan_NEON(north, north_scan);
+                Peaks_Scan_NEON(east, east_scan);
+                return;
+#endif
+        default:
+                Peaks_Scan_C(north, north_scan);
+                Peaks_Scan_C(east, east_scan);
+                return;
+        }
+}
+
+
+//==================================================================
+// Fused scan: Peaks_Scan of the filtered channels straight from the
+// packed words, filtering each sample as it is needed. Sample X of a
+// filtered channel is the sum of raw samples X..X+3, and the last four
+// all hold the sum of the last four raw samples.
+//
+#define FUSED_END (BOLTEK_BUFFERSIZE - 8)   /*  vectors stop short of the filter's tail  */
+
+static inline int
+Fused_Sample(const __u16 *raw, int X)
+{
+        if (X > BOLTEK_BUFFERSIZE - 4) X = BOLTEK_BUFFERSIZE - 4;
+        return (raw[X] & 0xff) + (raw[X + 1] & 0xff) + (raw[X + 2] & 0xff) + (raw[X + 3] & 0xff);
+}
+
+// filtered sample X of a channel, for the lookups after the scan
+int
+Fused_Filtered(const __u16 *raw, int X)
+{
+        return Fused_Sample(raw, X);
+}
+
+// Peaks_Scan_C over filtered samples from..to-1, carrying on from scan
+static void
+Fused_Scan_Range(const __u16 *raw, struct peak_scan *scan, int from, int to)
+{
+        int Count, v;
+
+        for (Count = from; Count < to; Count++)
+        {
+                v = Fused_Sample(raw, Count);
+                if (v > scan->max)
+                {
+                        scan->max = v;
+                        scan->max_pos = Count;
+                }
+                if (v < scan->min)
+                {
+                        scan->min = v;
+                        scan->min_pos = Count;
+                }
+                scan->clip_pos += v == MAXBUFVAL;
+                scan->clip_neg += v == 0;
+        }
+        return;
+}
+
+static void
+Fused_Start(struct peak_scan *scan)
+{
+        scan->max = 0;
+        scan->min = 32000;
+        scan->max_pos = scan->min_pos = 3;
+        scan->clip_pos = scan->clip_neg = 0;
+        return;
+}
+
+// merge 16 bit lanes, see Peaks_Merge
+static void
+Fused_Merge(struct peak_scan *scan, const short *max, const short *max_pos, const short *min,
+            const short *min_pos, const short *clip_pos, const short *clip_neg, int lanes)
+{
+        int imax[16], imax_pos[16], imin[16], imin_pos[16], iclip_pos[16], iclip_neg[16];
+        int lane;
+
+        for (lane = 0; lane < lanes; lane++)
+        {
+                imax[lane] = max[lane];
+                imax_pos[lane] = max_pos[lane];
+                imin[lane] = min[lane];
+                imin_pos[lane] = min_pos[lane];
+                iclip_pos[lane] = clip_pos[lane];
+                iclip_neg[lane] = clip_neg[lane];
+        }
+        Peaks_Merge(scan, imax, imax_pos, imin, imin_pos, iclip_pos, iclip_neg, lanes);
+        return;
+}
+
+#if SIMD_X86
+// samples and positions fit in 16 bits, so 8 lanes to a register
+__attribute__((target("sse2")))
+static inline __m128i
+Fused_Load_SSE2(const __u16 *raw, int X)
+{
+        const __m128i low = _mm_set1_epi16 (0xff);
+        __m128i sum;
+
+        sum = _mm_and_si128 (_mm_loadu_si128 ((const __m128i *) &raw[X]), low);
+        sum = _mm_add_epi16 (sum, _mm_and_si128 (_mm_loadu_si128 ((const __m128i *) &raw[X + 1]), low));
+        sum = _mm_add_epi16 (sum, _mm_and_si128 (_mm_loadu_si128 ((const __m128i *) &raw[X + 2]), low));
+        return _mm_add_epi16 (sum, _mm_and_si128 (_mm_loadu_si128 ((const __m128i *) &raw[X + 3]), low));
+}
+
+__attribute__((target("sse2")))
+static void
+Fused_Scan_SSE2(const __u16 *raw, struct peak_scan *scan)
+{
+        short max[8], max_pos[8], min[8], min_pos[8], clip_pos[8], clip_neg[8];
+        __m128i vmax = _mm_set1_epi16 (scan->max), vmin = _mm_set1_epi16 (scan->min);
+        __m128i vmax_pos = _mm_set1_epi16 (-1), vmin_pos = _mm_set1_epi16 (-1);
+        __m128i vclip_pos = _mm_setzero_si128 (), vclip_neg = _mm_setzero_si128 ();
+        const __m128i top = _mm_set1_epi16 (MAXBUFVAL), zero = _mm_setzero_si128 (), eight = _mm_set1_epi16 (8);
+        __m128i pos = _mm_add_epi16 (_mm_set1_epi16 (SCAN_FIRST), _mm_setr_epi16 (0, 1, 2, 3, 4, 5, 6, 7));
+        __m128i v, gt, lt;
+        int cnt;
+
+        for (cnt = SCAN_FIRST; cnt < FUSED_END; cnt += 8)
+        {
+                v = Fused_Load_SSE2(raw, cnt);
+                gt = _mm_cmpgt_epi16 (v, vmax);
+                lt = _mm_cmplt_epi16 (v, vmin);
+                vmax = _mm_max_epi16 (v, vmax);
+                vmax_pos = Select_SSE2(gt, pos, vmax_pos);
+                vmin = _mm_min_epi16 (v, vmin);
+                vmin_pos = Select_SSE2(lt, pos, vmin_pos);
+                vclip_pos = _mm_sub_epi16 (vclip_pos, _mm_cmpeq_epi16 (v, top));
+                vclip_neg = _mm_sub_epi16 (vclip_neg, _mm_cmpeq_epi16 (v, zero));
+                pos = _mm_add_epi16 (pos, eight);
+        }
+        _mm_storeu_si128 ((__m128i *) max, vmax);
+        _mm_storeu_si128 ((__m128i *) max_pos, vmax_pos);
+        _mm_storeu_si128 ((__m128i *) min, vmin);
+        _mm_storeu_si128 ((__m128i *) min_pos, vmin_pos);
+        _mm_storeu_si128 ((__m128i *) clip_pos, vclip_pos);
+        _mm_storeu_si128 ((__m128i *) clip_neg, vclip_neg);
+        Fused_Merge(scan, max, max_pos, min, min_pos, clip_pos, clip_neg, 8);
+        return;
+}
+
+__attribute__((target("avx2")))
+static inline __m256i
+Fused_Load_AVX2(const __u16 *raw, int X)
+{
+        const __m256i low = _mm256_set1_epi16 (0xff);
+        __m256i sum;
+
+        sum = _mm256_and_si256 (_mm256_loadu_si256 ((const __m256i *) &raw[X]), low);
+        sum = _mm256_add_epi16 (sum, _mm256_and_si256 (_mm256_loadu_si256 ((const __m256i *) &raw[X + 1]), low));
+        sum = _mm256_add_epi16 (sum, _mm256_and_si256 (_mm256_loadu_si256 ((const __m256i *) &raw[X + 2]), low));
+        return _mm256_add_epi16 (sum, _mm256_and_si256 (_mm256_loadu_si256 ((const __m256i *) &raw[X + 3]), low));
+}
+
+__attribute__((target("avx2")))
+static void
+Fused_Scan_AVX2(const __u16 *raw, struct peak_scan *scan)
+{
+        short max[16], max_pos[16], min[16], min_pos[16], clip_pos[16], clip_neg[16];
+        __m256i vmax = _mm256_set1_epi16 (scan->max), vmin = _mm256_set1_epi16 (scan->min);
+        __m256i vmax_pos = _mm256_set1_epi16 (-1), vmin_pos = _mm256_set1_epi16 (-1);
+        __m256i vclip_pos = _mm256_setzero_si256 (), vclip_neg = _mm256_setzero_si256 ();
+        const __m256i top = _mm256_set1_epi16 (MAXBUFVAL), zero = _mm256_setzero_si256 ();
+        const __m256i sixteen = _mm256_set1_epi16 (16);
+        __m256i pos = _mm256_add_epi16 (_mm256_set1_epi16 (SCAN_FIRST),
+                                        _mm256_setr_epi16 (0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15));
+        __m256i v, gt, lt;
+        int cnt;
+
+        for (cnt = SCAN_FIRST; cnt < FUSED_END; cnt += 16)
+        {
+                v = Fused_Load_AVX2(raw, cnt);
+                gt = _mm256_cmpgt_epi16 (v, vmax);
+                lt = _mm256_cmpgt_epi16 (vmin, v);
+                vmax = _mm256_max_epi16 (v, vmax);
+                vmax_pos = _mm256_blendv_epi8 (vmax_pos, pos, gt);
+                vmin = _mm256_min_epi16 (v, vmin);
+                vmin_pos = _mm256_blendv_epi8 (vmin_pos, pos, lt);
+                vclip_pos = _mm256_sub_epi16 (vclip_pos, _mm256_cmpeq_epi16 (v, top));
+                vclip_neg = _mm256_sub_epi16 (vclip_neg, _mm256_cmpeq_epi16 (v, zero));
+                pos = _mm256_add_epi16 (pos, sixteen);
+        }
+        _mm256_storeu_si256 ((__m256i *) max, vmax);
+        _mm256_storeu_si256 ((__m256i *) max_pos, vmax_pos);
+        _mm256_storeu_si256 ((__m256i *) min, vmin);
+        _mm256_storeu_si256 ((__m256i *) min_pos, vmin_pos);
+        _mm256_storeu_si256 ((__m256i *) clip_pos, vclip_pos);
+        _mm256_storeu_si256 ((__m256i *) clip_neg, vclip_neg);
+        Fused_Merge(scan, max, max_pos, min, min_pos, clip_pos, clip_neg, 16);
+        return;
+}
+#endif
+
+#if SIMD_ARM
+SIMD_NEON_TARGET
+static inline int16x8_t
+Fused_Load_NEON(const __u16 *raw, int X)
+{
+        const uint16x8_t low = vdupq_n_u16 (0xff);
+        uint16x8_t sum;
+
+        sum = vandq_u16 (vld1q_u16 (&raw[X]), low);
+        sum = vaddq_u16 (sum, vandq_u16 (vld1q_u16 (&raw[X + 1]), low));
+        sum = vaddq_u16 (sum, vandq_u16 (vld1q_u16 (&raw[X + 2]), low));
+        sum = vaddq_u16 (sum, vandq_u16 (vld1q_u16 (&raw[X + 3]), low));
+        return vreinterpretq_s16_u16 (sum);
+}
+
+SIMD_NEON_TARGET
+static void
+Fused_Scan_NEON(const __u16 *raw, struct peak_scan *scan)
+{
+        short max[8], max_pos[8], min[8], min_pos[8], clip_pos[8], clip_neg[8];
+        int16x8_t vmax = vdupq_n_s16 (scan->max), vmin = vdupq_n_s16 (scan->min);
+        int16x8_t vmax_pos = vdupq_n_s16 (-1), vmin_pos = vdupq_n_s16 (-1);
+        int16x8_t vclip_pos = vdupq_n_s16 (0), vclip_neg = vdupq_n_s16 (0);
+        const int16x8_t top = vdupq_n_s16 (MAXBUFVAL), zero = vdupq_n_s16 (0), eight = vdupq_n_s16 (8);
+        static const short first[8] = { SCAN_FIRST, SCAN_FIRST + 1, SCAN_FIRST + 2, SCAN_FIRST + 3,
+                                        SCAN_FIRST + 4, SCAN_FIRST + 5, SCAN_FIRST + 6, SCAN_FIRST + 7 };
+        int16x8_t pos = vld1q_s16 (first);
+        int16x8_t v;
+        uint16x8_t gt, lt;
+        int cnt;
+
+        for (cnt = SCAN_FIRST; cnt < FUSED_END; cnt += 8)
+        {
+                v = Fused_Load_NEON(raw, cnt);
+                gt = vcgtq_s16 (v, vmax);
+                lt = vcltq_s16 (v, vmin);
+                vmax = vmaxq_s16 (v, vmax);
+                vmax_pos = vbslq_s16 (gt, pos, vmax_pos);
+                vmin = vminq_s16 (v, vmin);
+                vmin_pos = vbslq_s16 (lt, pos, vmin_pos);
+                vclip_pos = vsubq_s16 (vclip_pos, vreinterpretq_s16_u16 (vceqq_s16 (v, top)));
+                vclip_neg = vsubq_s16 (vclip_neg, vreinterpretq_s16_u16 (vceqq_s16 (v, zero)));
+                pos = vaddq_s16 (pos, eight);
+        }
+        vst1q_s16 (max, vmax);
+        vst1q_s16 (max_pos, vmax_pos);
+        vst1q_s16 (min, vmin);
+        vst1q_s16 (min_pos, vmin_pos);
+        vst1q_s16 (clip_pos, vclip_pos);
+        vst1q_s16 (clip_neg, vclip_neg);
+        Fused_Merge(scan, max, max_pos, min, min_pos, clip_pos, clip_neg, 8);
+        return;
+}
+#endif
+
+// Peaks_Scan of both filtered channels of a packed capture
+void
+Fused_Scan(const StormProcess_tPACKEDDATA *packed, struct peak_scan *north, struct peak_scan *east)
+{
+        void (*scan)(const __u16 *raw, struct peak_scan *scan) = NULL;
+
+        switch (Simd_Level())
+        {
+#if SIMD_X86
+        case SIMD_AVX2:
+                scan = Fused_Scan_AVX2;
+                break;
+        case SIMD_SSE2:
+                scan = Fused_Scan_SSE2;
+                break;
+#endif
+#if SIMD_ARM
+        case SIMD_NEON:
+                scan = Fused_Scan_NEON;
+                break;
+#endif
+        }
+
+        Fused_Start(north);
+        Fused_Start(east);
+        if (scan == NULL)
+        {
+                Fused_Scan_Range(packed->usNorth, north, 3, BOLTEK_BUFFERSIZE);
+                Fused_Scan_Range(packed->usWest, east, 3, BOLTEK_BUFFERSIZE);
+                return;
+        }
+        Fused_Scan_Range(packed->usNorth, north, 3, SCAN_FIRST);
+        Fused_Scan_Range(packed->usWest, east, 3, SCAN_FIRST);
+        scan (packed->usNorth, north);
+        scan (packed->usWest, east);
+        Fused_Scan_Range(packed->usNorth, north, FUSED_END, BOLTEK_BUFFERSIZE);
+        Fused_Scan_Range(packed->usWest, east, FUSED_END, BOLTEK_BUFFERSIZE);
+        return;
+}
+
+
+//==================================================================
+// Gather: the high bytes of n words, where the timestamp and GPS data
+// travel. The vectors take 16 or 32 words at a time, C the rest.
+//
+static void
+Gather_C(const __u16 *words, unsigned char *bytes, int from, int n)
+{
+        int cnt;
+
+        for (cnt = from; cnt < n; cnt++)
+                bytes[cnt] = words[cnt] >> 8;
+        return;
+}
+
+#if SIMD_X86
+__attribute__((target("sse2")))
+static int
+Gather_SSE2(const __u16 *words, unsigned char *bytes, int n)
+{
+        __m128i a, b;
+        int cnt;
+
+        for (cnt = 0; cnt + 16 <= n; cnt += 16)
+        {
+                a = _mm_srli_epi16 (_mm_loadu_si128 ((const __m128i *) &words[cnt]), 8);
+                b = _mm_srli_epi16 (_mm_loadu_si128 ((const __m128i *) &words[cnt + 8]), 8);
+                _mm_storeu_si128 ((__m128i *) &bytes[cnt], _mm_packus_epi16 (a, b));
+        }
+        return cnt;
+}
+
+__attribute__((target("avx2")))
+static int
+Gather_AVX2(const __u16 *words, unsigned char *bytes, int n)
+{
+        __m256i a, b;
+        int cnt;
+
+        for (cnt = 0; cnt + 32 <= n; cnt += 32)
+        {
+                a = _mm256_srli_epi16 (_mm256_loadu_si256 ((const __m256i *) &words[cnt]), 8);
+                b = _mm256_srli_epi16 (_mm256_loadu_si256 ((const __m256i *) &words[cnt + 16]), 8);
+                /*  packus works within 128 bit lanes, put the quads back in order  */
+                _mm256_storeu_si256 ((__m256i *) &bytes[cnt],
+                                     _mm256_permute4x64_epi64 (_mm256_packus_epi16 (a, b), 0xd8));
+        }
+        return cnt;
+}
+#endif
+
+#if SIMD_ARM
+SIMD_NEON_TARGET
+static int
+Gather_NEON(const __u16 *words, unsigned char *bytes, int n)
+{
+        int cnt;
+
+        for (cnt = 0; cnt + 16 <= n; cnt += 16)
+                vst1q_u8 (&bytes[cnt], vcombine_u8 (vshrn_n_u16 (vld1q_u16 (&words[cnt]), 8),
+                                                    vshrn_n_u16 (vld1q_u16 (&words[cnt + 8]), 8)));
+        return cnt;
+}
+#endif
+
+void
+Gather_High(const __u16 *words, unsigned char *bytes, int n)
+{
+        int done = 0;
+
+        switch (Simd_Level())
+        {
+#if SIMD_X86
+        case SIMD_AVX2:
+                done = Gather_AVX2(words, bytes, n);
+                done += Gather_SSE2(words + done, bytes + done, n - done);
+                break;
+        case SIMD_SSE2:
+                done = Gather_SSE2(words, bytes, n);
+                break;
+#endif
+#if SIMD_ARM
+        case SIMD_NEON:
+                done = Gather_NEON(words, bytes, n);
+                break;
+#endif
+        }
+        Gather_C(words, bytes, done, n);
+        return;
+}
@@ -0,0 +1,219 @@
+/* Adaptive squelch for the Boltek Lightning Detector SDK
+   Keeps a card's trigger level where what it captures is mostly
+   strikes, see StormPCI_SquelchUpdate() in stormpci.h. Captures are
+   counted in SQUELCH_SLICES slices of the window, so old ones drop out
+   a slice at a time instead of being kept one by one. A change of level
+   starts the count afresh, the level is judged only by the captures
+   taken at it.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "stormpci.h"
+
+#define SQUELCH_SLICES 30
+#define SQUELCH_LEVELS 16       /*  0-15, see StormPCI_SetSquelch()  */
+
+#define DEFAULT_SQUELCH_PARAMS { 0, 0, SQUELCH_LEVELS - 1, 0.5, 0.2, 20.0, 10, \
+                                 60000, 10000, 300000 }
+
+struct squelch_slice
+{
+        long long slice;                // time_ms / slice_ms of the captures counted
+        unsigned int captures, valid;
+};
+
+struct StormPCI_Squelch
+{
+        StormPCI_Context *pci;
+        StormPCI_tSQUELCHPARAMS params;
+        int level;
+        int started;                    // since and raised are set
+        long long since;                // ms the level was set, the window starts
+        long long raised;               // ms of the last step up
+        long long last;                 // latest time_ms, a clock going back is held here
+        int slice_ms;
+        unsigned int captures, valid;   // the sums of the slices
+        struct squelch_slice slices[SQUELCH_SLICES];
+};
+
+
+void
+StormPCI_DefaultSquelchParams(StormPCI_tSQUELCHPARAMS *params)
+{
+        static const StormPCI_tSQUELCHPARAMS defaults = DEFAULT_SQUELCH_PARAMS;
+
+        *params = defaults;
+        return;
+}
+
+StormPCI_Squelch*
+StormPCI_CreateSquelch(StormPCI_Context *ctx, const StormPCI_tSQUELCHPARAMS *params)
+{
+        StormPCI_Squelch *squelch;
+        StormPCI_tSQUELCHPARAMS defaults;
+
+        if (params == NULL)
+        {
+                StormPCI_DefaultSquelchParams(&defaults);
+                params = &defaults;
+        }
+        if (params->min_level < 0 || params->max_level >= SQUELCH_LEVELS ||
+            params->min_level > params->start_level || params->start_level > params->max_level ||
+            params->target_valid < 0.0 || params->target_valid > 1.0 ||
+            params->hysteresis < 0.0 || params->max_rate <= 0.0 ||
+            params->min_captures < 1 || params->window_ms < SQUELCH_SLICES ||
+            params->hold_ms < 0 || params->relax_ms < 0)
+                return NULL;
+
+        squelch = calloc (1, sizeof(*squelch));
+        if (squelch == NULL) return NULL;
+        squelch->pci = ctx;
+        squelch->params = *params;
+        squelch->level = params->start_level;
+        squelch->slice_ms = params->window_ms / SQUELCH_SLICES;
+        if (!StormPCI_SetSquelchCtx(ctx, (char) squelch->level))
+        {
+                free (squelch);
+                return NULL;
+        }
+        return squelch;
+}
+
+void
+StormPCI_DestroySquelch(StormPCI_Squelch *squelch)
+{
+        free (squelch);
+        return;
+}
+
+int
+StormPCI_SquelchLevel(StormPCI_Squelch *squelch)
+{
+        return squelch->level;
+}
+
+static long long
+Squelch_Now(void)
+{
+        struct timespec now;
+
+        clock_gettime (CLOCK_MONOTONIC, &now);
+        return now.tv_sec * 1000LL + now.tv_nsec / 1000000;
+}
+
+// drop the slices that have left the window ending at slice now
+static void
+Squelch_Expire(StormPCI_Squelch *squelch, long long now)
+{
+        struct squelch_slice *slice;
+        int i;
+
+        for (i = 0; i < SQUELCH_SLICES; i++)
+        {
+                slice = &squelch->slices[i];
+                if (slice->slice > now - SQUELCH_SLICES) continue;
+                squelch->captures -= slice->captures;
+                squelch->valid -= slice->valid;
+                slice->captures = slice->valid = 0;
+        }
+        return;
+}
+
+static void
+Squelch_Count(StormPCI_Squelch *squelch, long long now, int valid)
+{
+        struct squelch_slice *slice = &squelch->slices[now % SQUELCH_SLICES];
+
+        slice->slice = now;
+        slice->captures++;
+        squelch->captures++;
+        if (valid)
+        {
+                slice->valid++;
+                squelch->valid++;
+        }
+        return;
+}
+
+// change to level, and start counting afresh - zero if the card refused
+// it, the level is kept and tried again after another hold_ms
+static int
+Squelch_Set(StormPCI_Squelch *squelch, int level, long long time_ms, double ratio, double rate,
+            StormPCI_tSQUELCHEVENT *event)
+{
+        if (!StormPCI_SetSquelchCtx(squelch->pci, (char) level))
+        {
+                squelch->since = time_ms;
+                return 0;
+        }
+
+        event->time_ms = time_ms;
+        event->old_level = squelch->level;
+        event->new_level = level;
+        event->valid_ratio = ratio;
+        event->trigger_rate = rate;
+        event->captures = squelch->captures;
+
+        if (level > squelch->level)
+                squelch->raised = time_ms;
+        squelch->level = level;
+        squelch->since = time_ms;
+        squelch->captures = squelch->valid = 0;
+        memset (squelch->slices, 0, sizeof(squelch->slices));
+        return 1;
+}
+
+int
+StormPCI_SquelchUpdate(StormPCI_Squelch *squelch, const StormProcess_tSTRIKE *strike,
+                       long long time_ms, StormPCI_tSQUELCHEVENT *event)
+{
+        const StormPCI_tSQUELCHPARAMS *params = &squelch->params;
+        StormPCI_tSQUELCHEVENT unused;
+        long long covered;
+        double rate, ratio;
+        int quiet;
+
+        if (time_ms < 0) time_ms = Squelch_Now();
+        if (event == NULL) event = &unused;
+        if (!squelch->started)
+        {
+                squelch->started = 1;
+                squelch->since = squelch->last = time_ms;
+                squelch->raised = time_ms - params->relax_ms;
+        }
+        if (time_ms < squelch->last) time_ms = squelch->last;
+        squelch->last = time_ms;
+
+        Squelch_Expire(squelch, time_ms / squelch->slice_ms);
+        if (strike)
+                Squelch_Count(squelch, time_ms / squelch->slice_ms, strike->valid);
+
+        /*  judge a level only by a good while of captures taken at it  */
+        if (time_ms - squelch->since < params->hold_ms)
+                return 0;
+        covered = time_ms - squelch->since < params->window_ms ? time_ms - squelch->since : params->window_ms;
+        if (covered < squelch->slice_ms) covered = squelch->slice_ms;
+        rate = squelch->captures * 1000.0 / covered;
+        ratio = squelch->captures ? (double) squelch->valid / squelch->captures : 1.0;
+        quiet = squelch->captures < (unsigned int) params->min_captures;
+
+        /*  flooded with noise, or just too many triggers  */
+        if (!quiet && (rate > params->max_rate || ratio < params->target_valid - params->hysteresis))
+        {
+                if (squelch->level >= params->max_level) return 0;
+                return Squelch_Set(squelch, squelch->level + 1, time_ms, ratio, rate, event);
+        }
+
+        /*  mostly strikes, or next to nothing: try more sensitivity, but not
+            straight back into the noise that raised the level  */
+        if ((quiet || ratio > params->target_valid + params->hysteresis) &&
+            rate <= params->max_rate / 2 && time_ms - squelch->raised >= params->relax_ms)
+        {
+                if (squelch->level <= params->min_level) return 0;
+                return Squelch_Set(squelch, squelch->level - 1, time_ms, ratio, rate, event);
+        }
+        return 0;
+}
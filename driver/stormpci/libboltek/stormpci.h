@@ -1,6 +1,7 @@
 #ifndef STORMPCI_H
 #define STORMPCI_H
 
+#include <stddef.h>
 #include <linux/types.h>
 
 // The Public API
@@ -115,6 +116,31 @@ typedef struct stormpci_packed_data
 } StormProcess_tPACKEDDATA;
 
 
+// The compact layout of a capture, about a third the size of
+// StormProcess_tBOARDDATA: 16 bit samples (the filter's sums reach 1020),
+// one bit per E-field sample and the timestamp and GPS data left in the
+// packed capture, which must outlive it. See StormProcess_Timestamp2().
+typedef struct StormProcess_tBOARDDATA2_t
+{
+        __u16 NorthBuf[BOLTEK_BUFFERSIZE];
+        __u16 EastBuf[BOLTEK_BUFFERSIZE];
+        __u32 EFieldBits[BOLTEK_BUFFERSIZE / 32]; // sample n is bit n % 32 of word n / 32
+        const StormProcess_tPACKEDDATA *packed; // NULL when converted from StormProcess_tBOARDDATA
+
+        int NorthMaxPos, NorthMinPos, EastMaxPos, EastMinPos; // pos of signal peaks
+        int North_Pk, East_Pk;               // signal pk-pk amplitude
+        int NorthPol, EastPol, EFieldPol;         // signal polarity
+} StormProcess_tBOARDDATA2;
+
+
+// what the driver knows about a capture besides its samples
+typedef struct StormPCI_tCAPTUREINFO {
+        unsigned long long sequence; // triggers since the card was opened, from 1
+        long long timestamp_ns;      // CLOCK_MONOTONIC when it was read off the card
+        unsigned int missed;         // triggers dropped since the previous capture
+} StormPCI_tCAPTUREINFO;
+
+
 typedef struct StormProcess_tSTRIKE {
 	int valid; // data appars to be valid signal, not just noise
 	float distance;  // miles away, for close strike detection
@@ -122,8 +148,47 @@ typedef struct StormProcess_tSTRIKE {
 	float direction; // 0-360 degrees
 } StormProcess_tSTRIKE;
 
+// captures a StormProcess_Context has processed, and those rejected as
+// noise by the first check they failed. A rejected capture's strike is
+// all zero and leaves the bearing averages alone
+typedef struct StormProcess_tREJECTS {
+        unsigned long long captures;    // all captures processed
+        unsigned long long frequency;   // min and max closer than frequency_check
+        unsigned long long efield;      // E-field the same at both peaks of both channels
+} StormProcess_tREJECTS;
+
+
+// Tuning parameters of the single-site strike processing
+typedef struct StormProcess_tPARAMS {
+        int    e_field_offset;      // samples the E-Field leads the H-Field
+        int    frequency_check;     // min and max must be this far apart to be valid
+        double suckin;              // fraction of the screen sucked in towards the center
+        double r_screen_limit;      // strike X/Y are limited to this
+        double miles_scale;         // miles = distance * miles_scale / r_screen_limit
+        double screen_scaling;      // ignored since the bearing averages replaced the
+                                    // X/Y clamp, kept so the struct keeps its layout
+        int    average_duration;    // seconds a bearing average survives without strikes
+        double delta_plus_limit_m;  // limit far strikes pull out = (m*strikerate) + b
+        double delta_plus_limit_b;
+        double delta_minus_filter;  // reduce impact of close in strikes 0-1.0x
+        int    average_bins;        // bearings the circle is averaged in, 360 by default, up to 3600
+        int    average_spread;      // bearings either side a strike also pulls, up to 16
+} StormProcess_tPARAMS;
+
+// Contexts
+//
+// A StormPCI_Context owns one capture source, a StormProcess_Context
+// owns the bearing averages and tuning parameters of one detector. The
+// functions without a context argument use a default context of each
+// kind. Separate contexts can be used from separate threads; a single
+// context must only be used by one thread at a time.
+typedef struct StormPCI_Context StormPCI_Context;
+typedef struct StormProcess_Context StormProcess_Context;
+
 
 #define STORMTRACKER_DEVICE_NAME "/dev/lightning-0"
+#define STORMTRACKER_CARD_NAME   "/dev/lightning-%d"  // card N
+#define STORMTRACKER_MAX_CARDS   8
 
 // connect to the StormTracker card - non-zero on success
 int  StormPCI_OpenPciCard(void); 
@@ -140,16 +205,287 @@ void StormPCI_ForceTrigger(void);
 // check if a strike is waiting to be read by GetCapture()
 int  StormPCI_StrikeReady(void); 
 
-// 0-15, 0:most sensitive (preferred), 15: least sensitive
-void StormPCI_SetSquelch(char trig_level);
+// 0-15, 0:most sensitive (preferred), 15: least sensitive - non-zero on
+// success. A reader sharing a card it doesn't own the squelch of is refused
+int  StormPCI_SetSquelch(char trig_level);
 
 // retrieve the waiting capture
 void StormPCI_GetBoardData(StormProcess_tPACKEDDATA* board_data);
 
-void StormProcess_UnpackCaptureData(StormProcess_tPACKEDDATA *packed_data, StormProcess_tBOARDDATA* board_data);
+// retrieve the waiting capture and wait for the next one, in a single
+// call to the driver. info may be NULL - non-zero if a capture was ready
+int  StormPCI_GetCapture(StormProcess_tPACKEDDATA* board_data, StormPCI_tCAPTUREINFO* info);
+
+// sleep until a strike is ready or timeout_ms passes (-1 waits forever)
+// non-zero if a strike is ready
+int  StormPCI_WaitForStrike(int timeout_ms);
+
+// the waiting capture without copying it, NULL if none is ready. The
+// pointer stays valid until StormPCI_ReleaseCapture(), which replaces
+// the StormPCI_GetBoardData() / StormPCI_RestartBoard() pair. When the
+// card is shared with other readers the driver does not wait for
+// anyone, so a capture held while the card fills its whole ring is
+// overwritten.
+const StormProcess_tPACKEDDATA* StormPCI_PeekCapture(void);
+void StormPCI_ReleaseCapture(void);
+
+// non-zero once the source has handed out its last capture, as a replay
+// without STORMPCI_REPLAY_LOOP does; a card never runs dry
+int  StormPCI_Exhausted(void);
+
+
+// Capture backends
+//
+// The StormPCI_* calls above read from a backend, which is the card at
+// STORMTRACKER_DEVICE_NAME unless another one is selected. Backends can
+// only be changed while the card is closed.
+//
+// A capture file is a plain concatenation of StormProcess_tPACKEDDATA
+// records exactly as returned by StormPCI_GetBoardData().
+
+typedef struct StormPCI_tBACKEND
+{
+        const char *name;
+        int  (*open)(void *priv);           // non-zero on success
+        void (*close)(void *priv);
+        void (*release)(void *priv);        // backend deselected, may be NULL
+        void (*restart)(void *priv);
+        void (*force_trigger)(void *priv);
+        int  (*strike_ready)(void *priv);
+        int  (*set_squelch)(void *priv, char trig_level); // non-zero on success
+        int  (*get_data)(void *priv, StormProcess_tPACKEDDATA* board_data); // non-zero on success
+        int  (*wait_for_strike)(void *priv, int timeout_ms); // may be NULL, see below
+        // zero-copy access to the waiting capture, both may be NULL
+        const StormProcess_tPACKEDDATA* (*peek_data)(void *priv); // NULL if none is ready
+        void (*release_data)(void *priv);   // done with the peeked capture
+        // get_data and restart in one, may be NULL
+        int  (*get_capture)(void *priv, StormProcess_tPACKEDDATA* board_data, StormPCI_tCAPTUREINFO* info);
+        // non-zero when no capture will ever be ready again, may be NULL
+        int  (*exhausted)(void *priv);
+} StormPCI_tBACKEND;
+
+// backends without a wait_for_strike are polled with this
+int  StormPCI_PollForStrike(const StormPCI_tBACKEND* backend, void *priv, int timeout_ms);
+
+#define STORMPCI_REPLAY_PACED 0x01  // deliver captures at their GPS timestamp spacing
+#define STORMPCI_REPLAY_LOOP  0x02  // start over at the end instead of running dry
+
+// select a caller supplied backend - non-zero on success
+int  StormPCI_UseBackend(const StormPCI_tBACKEND* backend, void *priv);
+
+// read from a card, NULL for STORMTRACKER_DEVICE_NAME - non-zero on success
+int  StormPCI_UseDevice(const char *device_name);
+
+// read from card N, STORMTRACKER_CARD_NAME - non-zero on success
+int  StormPCI_UseCard(int card);
+
+// the numbers of the cards present, at most max of them - the count
+int  StormPCI_EnumerateCards(int cards[], int max);
+
+// replay a capture file - non-zero on success
+int  StormPCI_UseReplayFile(const char *filename, int flags);
+
+// replay captures held in memory, the array must outlive the backend
+// - non-zero on success
+int  StormPCI_UseMemory(const StormProcess_tPACKEDDATA* captures, size_t count, int flags);
+
+int  StormPCI_UseBackendCtx(StormPCI_Context* ctx, const StormPCI_tBACKEND* backend, void *priv);
+int  StormPCI_UseDeviceCtx(StormPCI_Context* ctx, const char *device_name);
+int  StormPCI_UseCardCtx(StormPCI_Context* ctx, int card);
+int  StormPCI_UseReplayFileCtx(StormPCI_Context* ctx, const char *filename, int flags);
+int  StormPCI_UseMemoryCtx(StormPCI_Context* ctx, const StormProcess_tPACKEDDATA* captures, size_t count, int flags);
+
+// Adaptive squelch
+//
+// A StormPCI_Squelch sets the squelch of a StormPCI_Context from the
+// captures it is fed: a step up when noise outnumbers strikes or the
+// card triggers faster than max_rate, a step down when the captures are
+// mostly strikes or few. Each level is held at least hold_ms, and after
+// noise no lower level is tried for relax_ms. Rates are measured over
+// the last window_ms, counted afresh at every change.
+
+typedef struct StormPCI_tSQUELCHPARAMS {
+        int    start_level;         // squelch set when the controller is created
+        int    min_level;           // 0-15, the range it stays in
+        int    max_level;
+        double target_valid;        // fraction of captures that should be strikes
+        double hysteresis;          // no change within target_valid +/- this
+        double max_rate;            // triggers a second that raise the squelch regardless
+        int    min_captures;        // fewer in the window is quiet, too few to judge noise
+        int    window_ms;           // captures are counted over this long
+        int    hold_ms;             // least time at a level
+        int    relax_ms;            // least time after a step up before a step down
+} StormPCI_tSQUELCHPARAMS;
+
+// a change of squelch, returned by StormPCI_SquelchUpdate()
+typedef struct StormPCI_tSQUELCHEVENT {
+        long long time_ms;          // the time passed to StormPCI_SquelchUpdate()
+        int    old_level, new_level;
+        double valid_ratio;         // strikes / captures over the window
+        double trigger_rate;        // captures a second over the window
+        unsigned int captures;      // in the window
+} StormPCI_tSQUELCHEVENT;
+
+typedef struct StormPCI_Squelch StormPCI_Squelch;
+
+void StormPCI_DefaultSquelchParams(StormPCI_tSQUELCHPARAMS* params);
+
+// params may be NULL for the defaults - NULL on failure, which includes
+// the start_level squelch not being taken by ctx, which must be open
+StormPCI_Squelch* StormPCI_CreateSquelch(StormPCI_Context* ctx, const StormPCI_tSQUELCHPARAMS* params);
+void StormPCI_DestroySquelch(StormPCI_Squelch* squelch);
+
+// count a capture's strike, or NULL when a wait for one timed out, at
+// time_ms (any millisecond clock, negative for CLOCK_MONOTONIC now).
+// Non-zero if the squelch was changed, as described by event (may be
+// NULL). A level the card refuses is not counted as a change
+int  StormPCI_SquelchUpdate(StormPCI_Squelch* squelch, const StormProcess_tSTRIKE* strike,
+                            long long time_ms, StormPCI_tSQUELCHEVENT* event);
+int  StormPCI_SquelchLevel(StormPCI_Squelch* squelch);
+
+void StormProcess_UnpackCaptureData(const StormProcess_tPACKEDDATA *packed_data, StormProcess_tBOARDDATA* board_data);
+
+// the timestamp and GPS parts of the tTIMESTAMPINFO of a capture, for
+// applications that don't unpack it. DecodeTimestamp fills the TS_ fields
+// and capture_time, DecodeGPS the others; a GPS record identical to the
+// previous one the thread decoded is copied, not decoded again
+void StormProcess_DecodeTimestamp(const StormProcess_tPACKEDDATA *packed_data, StormProcess_tTIMESTAMPINFO* info);
+void StormProcess_DecodeGPS(const StormProcess_tPACKEDDATA *packed_data, StormProcess_tTIMESTAMPINFO* info);
 
 StormProcess_tSTRIKE StormProcess_SSProcessCapture(StormProcess_tBOARDDATA* capture);
 
+// the compact layout, the same strikes as the calls above
+void StormProcess_UnpackCaptureData2(const StormProcess_tPACKEDDATA *packed_data, StormProcess_tBOARDDATA2* board_data);
+StormProcess_tSTRIKE StormProcess_SSProcessCapture2(StormProcess_tBOARDDATA2* capture);
+StormProcess_tTIMESTAMPINFO StormProcess_Timestamp2(const StormProcess_tBOARDDATA2* capture); // zeroed without packed
+void StormProcess_ConvertToBoardData2(const StormProcess_tBOARDDATA* from, StormProcess_tBOARDDATA2* to);
+void StormProcess_ConvertFromBoardData2(const StormProcess_tBOARDDATA2* from, StormProcess_tBOARDDATA* to);
+
+// StormPCI_Context API - as above, operating on the given context
+
+StormPCI_Context* StormPCI_DefaultContext(void);
+StormPCI_Context* StormPCI_CreateContext(void); // NULL on failure
+void StormPCI_DestroyContext(StormPCI_Context* ctx);
+
+int  StormPCI_OpenPciCardCtx(StormPCI_Context* ctx);
+void StormPCI_ClosePciCardCtx(StormPCI_Context* ctx);
+void StormPCI_RestartBoardCtx(StormPCI_Context* ctx);
+void StormPCI_ForceTriggerCtx(StormPCI_Context* ctx);
+int  StormPCI_StrikeReadyCtx(StormPCI_Context* ctx);
+int  StormPCI_SetSquelchCtx(StormPCI_Context* ctx, char trig_level);
+void StormPCI_GetBoardDataCtx(StormPCI_Context* ctx, StormProcess_tPACKEDDATA* board_data);
+int  StormPCI_WaitForStrikeCtx(StormPCI_Context* ctx, int timeout_ms);
+int  StormPCI_GetCaptureCtx(StormPCI_Context* ctx, StormProcess_tPACKEDDATA* board_data, StormPCI_tCAPTUREINFO* info);
+const StormProcess_tPACKEDDATA* StormPCI_PeekCaptureCtx(StormPCI_Context* ctx);
+void StormPCI_ReleaseCaptureCtx(StormPCI_Context* ctx);
+int  StormPCI_ExhaustedCtx(StormPCI_Context* ctx);
+
+// StormProcess_Context API
+
+void StormProcess_DefaultParams(StormProcess_tPARAMS* params);
+
+StormProcess_Context* StormProcess_DefaultContext(void);
+// params may be NULL for the defaults - NULL on failure
+StormProcess_Context* StormProcess_CreateContext(const StormProcess_tPARAMS* params);
+void StormProcess_DestroyContext(StormProcess_Context* ctx);
+
+// non-zero on success, the context is unchanged if params are out of range
+int  StormProcess_SetParams(StormProcess_Context* ctx, const StormProcess_tPARAMS* params);
+void StormProcess_GetParams(StormProcess_Context* ctx, StormProcess_tPARAMS* params);
+
+// how the strike position is worked out: STORMPROCESS_MATH_EXACT (the
+// default) in double precision, STORMPROCESS_MATH_FAST in single precision
+// without libm, STORMPROCESS_MATH_FIXED in integer arithmetic for hosts
+// without an FPU, within the error bounds given in the Documentation.
+// Changing to or from STORMPROCESS_MATH_FIXED forgets the bearing
+// averages - non-zero on success
+#define STORMPROCESS_MATH_EXACT 0
+#define STORMPROCESS_MATH_FAST  1
+#define STORMPROCESS_MATH_FIXED 2
+int  StormProcess_SetMath(StormProcess_Context* ctx, int math);
+
+// forget all bearing averages
+void StormProcess_ResetAverages(StormProcess_Context* ctx);
+
+// the capture and reject counts since the context was created or reset
+void StormProcess_GetRejects(StormProcess_Context* ctx, StormProcess_tREJECTS* rejects);
+void StormProcess_ResetRejects(StormProcess_Context* ctx);
+
+StormProcess_tSTRIKE StormProcess_SSProcessCaptureCtx(StormProcess_Context* ctx, StormProcess_tBOARDDATA* capture);
+StormProcess_tSTRIKE StormProcess_SSProcessCapture2Ctx(StormProcess_Context* ctx, StormProcess_tBOARDDATA2* capture);
+
+// unpack and StormProcess_SSProcessCaptureCtx in one pass, straight from
+// the packed capture - the same strike, without the intermediate buffers
+StormProcess_tSTRIKE StormProcess_ProcessPacked(StormProcess_Context* ctx, const StormProcess_tPACKEDDATA* packed);
+
+// Batch processing
+//
+// Processes n captures in order, strikes_out[i] matching what unpacking
+// packed[i] and running StormProcess_SSProcessCaptureCtx on it would
+// give. The per-capture work is spread over a pool of threads owned by
+// the context; bearing averaging stays in capture order. Non-zero on
+// success.
+int  StormProcess_ProcessBatch(StormProcess_Context* ctx, const StormProcess_tPACKEDDATA packed[],
+                               size_t n, StormProcess_tSTRIKE strikes_out[]);
+
+// threads used by ProcessBatch: 0 for one per online cpu (default),
+// 1 for the calling thread only - non-zero on success
+int  StormProcess_SetThreads(StormProcess_Context* ctx, int threads);
+
+// Synthetic captures
+//
+// A StormProcess_Synth makes captures for load and stress testing
+// without a storm: strikes at a bearing and distance, the E-field bit
+// following them and the loops clipping for close ones, mixed with noise
+// triggers. Each carries a timestamp block and GPS record with good
+// checksums, so the GPS time, pacing and averaging all work. A stream
+// arrives at rate captures a second, from 1/60.0 (one a minute) to
+// 10000, spaced at random or evenly. The distances are worked back
+// through the params of the context the synth is made for; the bearing
+// is reported within 90-270, a strike from the other half of the circle
+// as its bearing +/- 180.
+
+typedef struct StormProcess_tSYNTHPARAMS {
+        double rate;                // captures a second, strikes and noise
+        int    regular;             // evenly spaced, otherwise at random
+        double noise;               // fraction of the captures that are noise triggers
+        double bearing;             // degrees, the middle of the storm
+        double bearing_spread;      // strikes fall within +/- this of bearing
+        double min_miles, max_miles;// and this far away
+        double floor;               // +/- counts of noise on every sample
+        long long start_ns;         // time of the first capture, ns since the epoch, 0 for now
+        double latitude, longitude; // degrees, in the GPS record
+        __u64 seed;                 // the same seed makes the same captures
+} StormProcess_tSYNTHPARAMS;
+
+// what a synthetic capture was made as
+typedef struct StormProcess_tSYNTHINFO {
+        long long time_ns;          // its GPS time
+        int    strike;              // 0 for a noise trigger
+        double bearing;             // degrees, of a strike
+        double miles;
+        int    clipped;             // the strike drove the loops past 0-255
+} StormProcess_tSYNTHINFO;
+
+typedef struct StormProcess_Synth StormProcess_Synth;
+
+void StormProcess_DefaultSynthParams(StormProcess_tSYNTHPARAMS* params);
+
+// ctx may be NULL for the default params, params NULL for the default
+// storm - NULL on failure
+StormProcess_Synth* StormProcess_CreateSynth(StormProcess_Context* ctx, const StormProcess_tSYNTHPARAMS* params);
+void StormProcess_DestroySynth(StormProcess_Synth* synth);
+
+// the next capture of the stream; info may be NULL
+void StormProcess_SynthCapture(StormProcess_Synth* synth, StormProcess_tPACKEDDATA* capture,
+                               StormProcess_tSYNTHINFO* info);
+
+// one strike or noise trigger, outside the stream
+void StormProcess_SynthStrike(StormProcess_Synth* synth, double bearing, double miles, long long time_ns,
+                              StormProcess_tPACKEDDATA* capture, StormProcess_tSYNTHINFO* info);
+void StormProcess_SynthNoise(StormProcess_Synth* synth, long long time_ns,
+                             StormProcess_tPACKEDDATA* capture, StormProcess_tSYNTHINFO* info);
+
 
 
 #endif
@@ -0,0 +1,228 @@
+#ifndef STORMPCI_INT_H
+#define STORMPCI_INT_H
+
+// Declarations shared between the libboltek source files.
+// Not part of the public API - applications include stormpci.h only.
+
+#include <stdlib.h>
+#include <time.h>
+
+#include "stormpci.h"
+
+struct boltek_ring_header;
+struct stormpci_capture_info;
+
+// the device backend's state, embedded in every StormPCI_Context
+struct device_source
+{
+        char *name;             // NULL for STORMTRACKER_DEVICE_NAME
+        int fd;
+        __u16 abi_version;      // boltek_abi_version of the driver
+
+        // the driver's capture ring, mapped when the driver supports it
+        struct boltek_ring_header *ring;
+        size_t ring_len;
+        const StormProcess_tPACKEDDATA *slots;
+        const struct stormpci_capture_info *infos;  // ABI 5, one per slot
+        unsigned long long sequence;        // get_capture on older drivers
+
+        // ABI 6 rings are shared by all readers, each keeping a cursor
+        int shared;
+        unsigned long long next;            // seq of the next capture to hand out
+        unsigned int missed;                // overwritten unread since the last capture
+
+        // peek_data without a mapped ring
+        const StormProcess_tPACKEDDATA *peeked;
+        StormProcess_tPACKEDDATA *copy;     // allocated by the first peek
+};
+
+struct StormPCI_Context
+{
+        const StormPCI_tBACKEND *backend;
+        void *backend_priv;
+        int opened;
+        struct device_source device;
+
+        // StormPCI_PeekCapture() on backends without peek_data
+        const StormProcess_tPACKEDDATA *peeked;
+        StormProcess_tPACKEDDATA *copy;     // allocated by the first peek
+
+        unsigned long long sequence;        // StormPCI_GetCapture() on backends without get_capture
+};
+
+struct batch_pool;
+
+#define AVERAGE_MAX_BINS 3600        // tenth of a degree bearings
+#define AVERAGE_MAX_SPREAD 16
+
+// STORMPROCESS_MATH_FIXED works in binary fixed point: distances in
+// screen units with FIX_DISTANCE_BITS fraction bits, bearings in degrees
+// with FIX_ANGLE_BITS, multipliers with FIX_RATIO_BITS and miles per
+// screen unit with FIX_MILES_BITS
+#define FIX_DISTANCE_BITS 28
+#define FIX_ANGLE_BITS 20
+#define FIX_RATIO_BITS 24
+#define FIX_MILES_BITS 16
+
+#define FIX_DISTANCE(x) ((__s32) ((x) * (1 << FIX_DISTANCE_BITS) + 0.5))
+#define FIX_ANGLE(x) ((__s32) ((x) * (1 << FIX_ANGLE_BITS) + 0.5))
+#define FIX_RATIO(x) ((__s64) ((x) * (1 << FIX_RATIO_BITS) + 0.5))
+#define FIX_MILES(x) ((__s64) ((x) * (1 << FIX_MILES_BITS) + 0.5))
+
+// the params STORMPROCESS_MATH_FIXED uses, see Fixed_Params()
+struct fixed_params
+{
+        __s32 suck_subtract;            // distance, r_screen_limit * suckin
+        __s64 suck_multiply;            // ratio, stretches the rest back to r_screen_limit
+        __s32 max_delta;                // distance, the most a strike pulls an average out
+        __s64 delta_minus_filter;       // ratio
+        __s64 miles;                    // miles_scale / r_screen_limit
+};
+
+struct StormProcess_Context
+{
+        StormProcess_tPARAMS params;
+        struct fixed_params fixed;      // params, for STORMPROCESS_MATH_FIXED
+        double Average[AVERAGE_MAX_BINS]; // average distance of each bearing
+        __s32 AverageFixed[AVERAGE_MAX_BINS];   // the same for STORMPROCESS_MATH_FIXED
+        long long AverageTime[AVERAGE_MAX_BINS];  // capture time the average was set, ms
+
+        StormProcess_tREJECTS rejects;  // StormProcess_GetRejects()
+        int math;                       // StormProcess_SetMath()
+        int threads;                    // StormProcess_SetThreads(), 0 = one per cpu
+        struct batch_pool *pool;        // created by the first StormProcess_ProcessBatch()
+};
+
+// strike position before averaging, the order independent part of
+// Capture_ConvertToStrike. STORMPROCESS_MATH_FIXED sets only the fixed_
+// fields
+struct strike_geometry
+{
+        double R_XValue, R_YValue;
+        double New_Distance;
+        double d_bearing;
+        __s32 fixed_distance;   // New_Distance, FIX_DISTANCE_BITS
+        __s32 fixed_bearing;    // d_bearing, FIX_ANGLE_BITS
+        long long time;         // Average_Clock() of the capture, set by the caller
+};
+
+// one channel's pass of the peak finding, see Peaks_Scan_C()
+struct peak_scan
+{
+        int max, min;
+        int max_pos, min_pos;           // first sample at max and min
+        int clip_pos, clip_neg;         // samples at MAXBUFVAL and 0
+};
+
+// the peak fields of StormProcess_tBOARDDATA, for either layout
+struct capture_peaks
+{
+        int NorthMaxPos, NorthMinPos, EastMaxPos, EastMinPos;
+        int North_Pk, East_Pk;
+};
+
+struct capture_pol
+{
+        int NorthPol, EastPol, EFieldPol;
+};
+
+#define MAXBUFVAL 1020    /*  1020 = 255 * 4 byte filter  */
+
+// why a capture is not a strike, by the first check it fails. The cheap
+// checks come first, a rejected capture skips the rest of the processing
+#define REJECT_NONE 0
+#define REJECT_FREQUENCY 1      // min and max closer than frequency_check
+#define REJECT_EFIELD 2         // the E-field does not change at the peaks
+
+// the channel with the larger swing decides where both are measured
+static inline int
+Peaks_NorthWins(const struct peak_scan *north, const struct peak_scan *east)
+{
+        return north->max - north->min > east->max - east->min;
+}
+
+// min and max too close together, high frequency noise. Needs only the
+// peak positions
+static inline int
+Valid_Frequency(const StormProcess_tPARAMS *params, const struct capture_peaks *peaks)
+{
+        return abs (peaks->NorthMaxPos - peaks->NorthMinPos) >= params->frequency_check;
+}
+
+// counts the capture against the context's rejects. Returns reject
+static inline int
+Capture_Count(StormProcess_Context *ctx, int reject)
+{
+        ctx->rejects.captures++;
+        if (reject == REJECT_FREQUENCY) ctx->rejects.frequency++;
+        if (reject == REJECT_EFIELD) ctx->rejects.efield++;
+        return reject;
+}
+
+// the strike of a rejected capture, all zero
+static inline StormProcess_tSTRIKE
+Capture_Rejected(void)
+{
+        StormProcess_tSTRIKE strike = { 0 };
+
+        return strike;
+}
+
+// gps.c
+StormProcess_tTIMESTAMPINFO ExtractGPSData(const StormProcess_tPACKEDDATA *packeddata);
+void Extract_Timestamp(const StormProcess_tPACKEDDATA *packeddata, StormProcess_tTIMESTAMPINFO *tgps);
+void Extract_GPS(const StormProcess_tPACKEDDATA *packeddata, StormProcess_tTIMESTAMPINFO *tgps);
+int  Timestamp_Seconds(const StormProcess_tTIMESTAMPINFO *ts, double *seconds);
+int  Timestamp_Millis(const StormProcess_tTIMESTAMPINFO *ts, long long *ms);
+
+// the processing stages of StormProcess_SSProcessCapture, in order
+void Capture_Filter(StormProcess_tBOARDDATA* capture);
+void Capture_Find_Peaks(StormProcess_tBOARDDATA* capture);
+int  Capture_Valid(const StormProcess_tPARAMS *params, StormProcess_tBOARDDATA* capture);   // REJECT_
+void Capture_Geometry(const StormProcess_Context *ctx, const StormProcess_tBOARDDATA* capture,
+                      struct strike_geometry *geom);
+int  Capture_Packed(const StormProcess_Context *ctx, const StormProcess_tPACKEDDATA *packed,
+                    struct strike_geometry *geom);                              // REJECT_
+
+// layout independent parts of the stages above
+void Peaks_Scan_C(const int *buf, struct peak_scan *scan);
+void Peaks_Positions(const struct peak_scan *north, const struct peak_scan *east, struct capture_peaks *peaks);
+void Peaks_Resolve(const struct peak_scan *north, const struct peak_scan *east, int other_pk,
+                   struct capture_peaks *peaks);
+int  Valid_EFieldPos(const StormProcess_tPARAMS *params, int pos);
+int  Valid_Decide(const StormProcess_tPARAMS *params, const struct capture_peaks *peaks,
+                  int NorthMinE_FCheck, int NorthMaxE_FCheck, int EastMinE_FCheck, int EastMaxE_FCheck,
+                  struct capture_pol *pol);
+void Geometry_FromPeaks(const StormProcess_tPARAMS *params, int North_Pk, int East_Pk,
+                        int NorthPol, int EastPol, struct strike_geometry *geom);
+void Geometry_Strike(const StormProcess_Context *ctx, int North_Pk, int East_Pk,
+                     int NorthPol, int EastPol, struct strike_geometry *geom);
+void Geometry_Fast(const StormProcess_tPARAMS *params, int North_Pk, int East_Pk,
+                   int NorthPol, int EastPol, struct strike_geometry *geom);     // fastmath.c
+
+// fixed.c
+int  Fixed_Params(const StormProcess_tPARAMS *params, struct fixed_params *fixed);
+void Geometry_Fixed(const struct fixed_params *fixed, int North_Pk, int East_Pk,
+                    int NorthPol, int EastPol, struct strike_geometry *geom);
+
+// average.c
+long long Average_Clock(const StormProcess_tTIMESTAMPINFO *ts);
+StormProcess_tSTRIKE Capture_Average(StormProcess_Context *ctx, const struct strike_geometry *geom);
+
+void Batch_Destroy(StormProcess_Context *ctx);
+
+// vector kernels, simd.c
+#define SIMD_NONE 0     // portable C
+#define SIMD_SSE2 1
+#define SIMD_NEON 2
+#define SIMD_AVX2 3
+
+int  Simd_Level(void);
+void Simd_Limit(int level);
+void Unpack_Samples(const StormProcess_tPACKEDDATA *packed, StormProcess_tBOARDDATA *board);
+void Peaks_Scan(const int *north, const int *east, struct peak_scan *north_scan, struct peak_scan *east_scan);
+void Fused_Scan(const StormProcess_tPACKEDDATA *packed, struct peak_scan *north, struct peak_scan *east);
+int  Fused_Filtered(const __u16 *raw, int X);
+void Gather_High(const __u16 *words, unsigned char *bytes, int n);
+
+#endif
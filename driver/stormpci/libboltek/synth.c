@@ -0,0 +1,376 @@
+/* Synthetic captures for the Boltek Lightning Detector SDK
+   Makes StormProcess_tPACKEDDATA captures for load and stress testing
+   without a storm, see StormProcess_CreateSynth() in stormpci.h. A
+   strike rings on both loops as a damped sine, in the proportions of
+   its bearing and at the size the processing turns back into its
+   distance; the E-field bit follows the ringing, e_field_offset samples
+   ahead. Noise triggers ring too fast to pass for a strike, or have an
+   E-field that never changes. The timestamp block and GPS record carry
+   the capture's time, with the checksums ExtractGPSData() checks.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include "stormpci.h"
+
+#define SYNTH_TS_BYTES 10       /*  timestamp block, as gps.c  */
+#define SYNTH_GPS_BYTES 157     /*  GPS record after it  */
+#define SYNTH_GPS_CHECKSUM 151  /*  XOR of record bytes 2..149  */
+#define SYNTH_SATELLITES 57     /*  12 entries of 6 bytes  */
+#define SYNTH_OSCILLATOR 50000000       /*  the timestamp's 50MHz clock  */
+#define SYNTH_ZERO 128          /*  converter output with no signal  */
+
+#define DEFAULT_SYNTH_PARAMS { 10.0, 0, 0.25, 180.0, 180.0, 20.0, 250.0, 1.0, 0, \
+                               45.0, -75.0, 1 }
+
+struct StormProcess_Synth
+{
+        StormProcess_tSYNTHPARAMS params;
+        StormProcess_tPARAMS process;   // the distances are worked back through
+        __u64 seed;
+        long long next_ns;              // time of the next capture of the stream
+        long long gps_second;           // the second gps was made for, -1 for none
+        unsigned char gps[SYNTH_GPS_BYTES];
+};
+
+
+static double
+Synth_Random(StormProcess_Synth *synth)
+{
+        synth->seed = synth->seed * 6364136223846793005ULL + 1442695040888963407ULL;
+        return (synth->seed >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static void
+Store_BE16(unsigned char *p, unsigned v)
+{
+        p[0] = v >> 8;
+        p[1] = v;
+        return;
+}
+
+static void
+Store_BE32(unsigned char *p, __u32 v)
+{
+        p[0] = v >> 24;
+        p[1] = v >> 16;
+        p[2] = v >> 8;
+        p[3] = v;
+        return;
+}
+
+static void
+Store_LE32(unsigned char *p, __u32 v)
+{
+        p[0] = v;
+        p[1] = v >> 8;
+        p[2] = v >> 16;
+        p[3] = v >> 24;
+        return;
+}
+
+// the proleptic gregorian date of days since 1970-01-01, the inverse
+// of DaysFromCivil in gps.c
+static void
+CivilFromDays(long days, int *year, int *month, int *day)
+{
+        long era, doe, yoe, doy, mp;
+
+        days += 719468;
+        era = (days >= 0 ? days : days - 146096) / 146097;
+        doe = days - era * 146097;
+        yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+        doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+        mp = (5 * doy + 2) / 153;
+        *day = doy - (153 * mp + 2) / 5 + 1;
+        *month = mp < 10 ? mp + 3 : mp - 9;
+        *year = yoe + era * 400 + (*month <= 2);
+        return;
+}
+
+// the receiver's record for a second, made once and kept while the
+// captures stay within it
+static void
+Synth_GPS(StormProcess_Synth *synth, long long second)
+{
+        unsigned char *rec = synth->gps;
+        unsigned char checksum = 0;
+        long days = (long) (second / 86400);
+        int secs = (int) (second % 86400);
+        int year, month, day, cnt;
+
+        if (second == synth->gps_second) return;
+        if (secs < 0)
+        {
+                secs += 86400;
+                days--;
+        }
+        CivilFromDays(days, &year, &month, &day);
+
+        memset (rec, 0, SYNTH_GPS_BYTES);
+        memcpy (rec, "@@Ha", 4);
+        rec[4] = month;
+        rec[5] = day;
+        Store_BE16(rec + 6, year);
+        rec[8] = secs / 3600;
+        rec[9] = secs / 60 % 60;
+        rec[10] = secs % 60;
+        Store_BE32(rec + 15, (__u32) (__s32) lround (synth->params.latitude * 3600000));
+        Store_BE32(rec + 19, (__u32) (__s32) lround (synth->params.longitude * 3600000));
+        Store_BE32(rec + 23, 25000);            /*  250m, in cm  */
+        Store_BE16(rec + 53, 12);               /*  DOP 1.2  */
+        rec[55] = 10;                           /*  visible  */
+        rec[56] = 8;                            /*  tracked  */
+        for (cnt = 0; cnt < 8; cnt++)
+        {
+                unsigned char *sat = rec + SYNTH_SATELLITES + cnt * 6;
+
+                sat[0] = 2 + 3 * cnt;           /*  SVID  */
+                sat[1] = 8;                     /*  tracking  */
+                sat[2] = 40 + cnt;              /*  signal strength  */
+                Store_BE16(sat + 4, 0x00a2);    /*  channel status  */
+        }
+        Store_BE16(rec + 129, 0x0000);          /*  receiver status  */
+        Store_BE16(rec + 139, 2 * 35);          /*  oscillator at 35C, in half degrees  */
+        Store_BE16(rec + 155, 1234);            /*  serial number  */
+
+        for (cnt = 2; cnt < 150; cnt++)
+                checksum ^= rec[cnt];
+        rec[SYNTH_GPS_CHECKSUM] = checksum;
+        rec[152] = '\r';
+        rec[153] = '\n';
+        synth->gps_second = second;
+        return;
+}
+
+// the timestamp block and GPS record of a capture at time_ns, in the high
+// bytes of usWest
+static void
+Synth_Time(StormProcess_Synth *synth, long long time_ns, StormProcess_tPACKEDDATA *capture)
+{
+        unsigned char ts[SYNTH_TS_BYTES];
+        long long second = time_ns / 1000000000;
+        long nanos = (long) (time_ns % 1000000000);
+        unsigned char sum = 0;
+        int cnt;
+
+        if (nanos < 0)
+        {
+                nanos += 1000000000;
+                second--;
+        }
+        Synth_GPS(synth, second);
+
+        /*  the bytes before the checksum byte add up to nothing, the low
+            byte of the oscillator count is what gives  */
+        memset (ts, 0, sizeof(ts));
+        ts[0] = nanos / 10000000;
+        Store_LE32(ts + 1, (__u32) nanos);
+        Store_LE32(ts + 5, SYNTH_OSCILLATOR + (int) (Synth_Random(synth) * 200) - 100);
+        for (cnt = 0; cnt < 8; cnt++)
+                if (cnt != 5) sum += ts[cnt];
+        ts[5] = (unsigned char) -sum;
+
+        for (cnt = 0; cnt < SYNTH_TS_BYTES; cnt++)
+                capture->usWest[cnt] = (capture->usWest[cnt] & 0xff) | ts[cnt] << 8;
+        for (cnt = 0; cnt < SYNTH_GPS_BYTES; cnt++)
+                capture->usWest[SYNTH_TS_BYTES + cnt] = (capture->usWest[SYNTH_TS_BYTES + cnt] & 0xff) |
+                        synth->gps[cnt] << 8;
+        return;
+}
+
+// one converter sample, with the noise floor; non-zero if it clipped
+static int
+Synth_Sample(StormProcess_Synth *synth, double value, __u16 *sample)
+{
+        int v = (int) lround (SYNTH_ZERO + value + synth->params.floor * (2 * Synth_Random(synth) - 1));
+
+        if (v < 0 || v > 255)
+        {
+                *sample = v < 0 ? 0 : 255;
+                return 1;
+        }
+        *sample = v;
+        return 0;
+}
+
+static void
+Synth_Info(StormProcess_tSYNTHINFO *info, long long time_ns, int strike, double bearing,
+           double miles, int clipped)
+{
+        if (info == NULL) return;
+        info->time_ns = time_ns;
+        info->strike = strike;
+        info->bearing = bearing;
+        info->miles = miles;
+        info->clipped = clipped;
+        return;
+}
+
+void
+StormProcess_SynthStrike(StormProcess_Synth *synth, double bearing, double miles, long long time_ns,
+                         StormProcess_tPACKEDDATA *capture, StormProcess_tSYNTHINFO *info)
+{
+        const StormProcess_tPARAMS *params = &synth->process;
+        double suck = params->r_screen_limit * params->suckin;
+        double omega = 0.025 + Synth_Random(synth) * 0.025;     /*  rad a sample, well below frequency_check  */
+        double decay = 80 + Synth_Random(synth) * 120;
+        int onset = 20 + (int) (Synth_Random(synth) * 20);
+        int flip = Synth_Random(synth) < 0.5;   /*  the stroke's polarity  */
+        double wave[BOLTEK_BUFFERSIZE + 4];
+        double distance, peak, north, east, filtered, max = 0, min = 0;
+        int cnt, clipped = 0;
+
+        for (cnt = 0; cnt < BOLTEK_BUFFERSIZE + 4; cnt++)
+                wave[cnt] = cnt < onset ? 0 : sin ((cnt - onset) * omega) * exp (-(cnt - onset) / decay);
+
+        /*  the pk-pk the processing sees is 1 / distance^2 before the
+            suck-in, measured after the four sample filter  */
+        for (cnt = 3; cnt < BOLTEK_BUFFERSIZE; cnt++)
+        {
+                filtered = wave[cnt] + wave[cnt + 1] + wave[cnt + 2] + wave[cnt + 3];
+                if (filtered > max) max = filtered;
+                if (filtered < min) min = filtered;
+        }
+        distance = miles * (params->r_screen_limit - suck) / params->miles_scale + suck;
+        peak = 1.0 / (distance * distance) / (max - min);
+
+        /*  the bearing reported is 270 degrees less the angle of the
+            signal on the loops, within 90-270  */
+        north = peak * cos ((270.0 - bearing) * M_PI / 180);
+        east = peak * sin ((270.0 - bearing) * M_PI / 180);
+        if (flip)
+        {
+                north = -north;
+                east = -east;
+        }
+
+        for (cnt = 0; cnt < BOLTEK_BUFFERSIZE; cnt++)
+        {
+                clipped |= Synth_Sample(synth, north * wave[cnt], &capture->usNorth[cnt]);
+                clipped |= Synth_Sample(synth, east * wave[cnt], &capture->usWest[cnt]);
+                if (cnt + params->e_field_offset < BOLTEK_BUFFERSIZE &&
+                    (wave[cnt + params->e_field_offset] > 0) != flip)
+                        capture->usNorth[cnt] |= 0x100;
+        }
+        Synth_Time(synth, time_ns, capture);
+        Synth_Info(info, time_ns, 1, bearing, miles, clipped);
+        return;
+}
+
+void
+StormProcess_SynthNoise(StormProcess_Synth *synth, long long time_ns,
+                        StormProcess_tPACKEDDATA *capture, StormProcess_tSYNTHINFO *info)
+{
+        double amplitude = 10 + Synth_Random(synth) * 90, angle = Synth_Random(synth) * 2 * M_PI;
+        int onset = 10 + (int) (Synth_Random(synth) * 100);
+        int chatter = Synth_Random(synth) < 0.5;
+        double omega, decay, wave;
+        int cnt, efield;
+
+        /*  a burst ringing too fast for a strike, its E-field chattering;
+            or a slow swing with an E-field that never changes  */
+        if (chatter)
+        {
+                omega = 0.3 + Synth_Random(synth) * 0.9;
+                decay = 5 + Synth_Random(synth) * 15;
+        }
+        else
+        {
+                omega = 0.02 + Synth_Random(synth) * 0.03;
+                decay = 60 + Synth_Random(synth) * 140;
+        }
+        efield = Synth_Random(synth) < 0.5;
+        for (cnt = 0; cnt < BOLTEK_BUFFERSIZE; cnt++)
+        {
+                wave = cnt < onset ? 0 : amplitude * sin ((cnt - onset) * omega) * exp (-(cnt - onset) / decay);
+                Synth_Sample(synth, wave * cos (angle), &capture->usNorth[cnt]);
+                Synth_Sample(synth, wave * sin (angle), &capture->usWest[cnt]);
+                if (chatter)
+                        efield = Synth_Random(synth) < 0.5;
+                if (efield)
+                        capture->usNorth[cnt] |= 0x100;
+        }
+        Synth_Time(synth, time_ns, capture);
+        Synth_Info(info, time_ns, 0, 0, 0, 0);
+        return;
+}
+
+void
+StormProcess_SynthCapture(StormProcess_Synth *synth, StormProcess_tPACKEDDATA *capture,
+                          StormProcess_tSYNTHINFO *info)
+{
+        const StormProcess_tSYNTHPARAMS *params = &synth->params;
+        long long time_ns = synth->next_ns;
+        double bearing, miles, gap;
+
+        if (Synth_Random(synth) < params->noise)
+                StormProcess_SynthNoise(synth, time_ns, capture, info);
+        else
+        {
+                bearing = params->bearing + (2 * Synth_Random(synth) - 1) * params->bearing_spread;
+                bearing = fmod (bearing + 360.0, 360.0);
+                miles = params->min_miles + Synth_Random(synth) * (params->max_miles - params->min_miles);
+                StormProcess_SynthStrike(synth, bearing, miles, time_ns, capture, info);
+        }
+
+        /*  exponential gaps for arrivals at random  */
+        gap = params->regular ? 1.0 / params->rate : -log (1.0 - Synth_Random(synth)) / params->rate;
+        synth->next_ns += (long long) (gap * 1e9) + 1;
+        return;
+}
+
+void
+StormProcess_DefaultSynthParams(StormProcess_tSYNTHPARAMS *params)
+{
+        static const StormProcess_tSYNTHPARAMS defaults = DEFAULT_SYNTH_PARAMS;
+
+        *params = defaults;
+        return;
+}
+
+StormProcess_Synth*
+StormProcess_CreateSynth(StormProcess_Context *ctx, const StormProcess_tSYNTHPARAMS *params)
+{
+        StormProcess_Synth *synth;
+        StormProcess_tSYNTHPARAMS defaults;
+        struct timespec now;
+
+        if (params == NULL)
+        {
+                StormProcess_DefaultSynthParams(&defaults);
+                params = &defaults;
+        }
+        if (!(params->rate > 0.0) || params->noise < 0.0 || params->noise > 1.0 ||
+            params->bearing_spread < 0.0 || params->min_miles < 0.0 ||
+            params->max_miles < params->min_miles || params->floor < 0.0 ||
+            fabs (params->latitude) > 90.0 || fabs (params->longitude) > 180.0)
+                return NULL;
+
+        synth = calloc (1, sizeof(*synth));
+        if (synth == NULL) return NULL;
+        synth->params = *params;
+        if (ctx)
+                StormProcess_GetParams(ctx, &synth->process);
+        else
+                StormProcess_DefaultParams(&synth->process);
+        synth->seed = params->seed;
+        synth->gps_second = -1;
+        synth->next_ns = params->start_ns;
+        if (synth->next_ns == 0)
+        {
+                clock_gettime (CLOCK_REALTIME, &now);
+                synth->next_ns = now.tv_sec * 1000000000LL + now.tv_nsec;
+        }
+        return synth;
+}
+
+void
+StormProcess_DestroySynth(StormProcess_Synth *synth)
+{
+        free (synth);
+        return;
+}